@@ -3,21 +3,36 @@
 #include "cbase/c_runes.h"
 
 #include "cbinmaps/c_binmap.h"
+#include "cbinmaps/c_utils.h"
 
 namespace ncore
 {
 	namespace binmaps
 	{
-		static inline u32	data_size_for(bin_t _root)
+		static inline u64	binmap_size_for(u64 _length)
 		{
-			u32 const data_size = (u32)(((((_root.base_length() * 2) + 7) / 8) * 2) + sizeof(bin_t));
+			u64 const binmap_size = ((_length * 2) + 7) / 8;
+			return binmap_size;
+		}
+
+		static inline u64	data_size_for(u64 _length)
+		{
+			u64 const data_size = (binmap_size_for(_length) * 2) + sizeof(bin_t);
 			return data_size;
 		}
 
+		static inline u64	data_size_for(bin_t _root)
+		{
+			return data_size_for(_root.base_length());
+		}
+
 		binmap::binmap()
             : binroot_(nullptr)
             , binmap1_(nullptr)
             , binmap0_(nullptr)
+            , length_(0)
+            , spine1_(0)
+            , spine0_(0)
 		{
 		}
 
@@ -25,11 +40,181 @@ namespace ncore
 			: binroot_((bin_t*)data)
 			, binmap1_(data + sizeof(bin_t))
 			, binmap0_(0)
+			, length_(root.base_length())
+			, spine1_(0)
+			, spine0_(0)
 		{
 			*binroot_ = root;
 
-			u32 const binmap_size = (data_size_for(root) - sizeof(bin_t)) / 2;
+			u64 const binmap_size = binmap_size_for(length_);
+			binmap0_ = binmap1_ + binmap_size;
+		}
+
+		/**
+		* Exact-length binmap, covers @length base bins as a forest of peak sub-trees
+		* instead of rounding the root up to the next power of two.
+		*/
+		binmap::binmap(u64 length, byte* data)
+			: binroot_((bin_t*)data)
+			, binmap1_(data + sizeof(bin_t))
+			, binmap0_(0)
+			, length_(length)
+			, spine1_(0)
+			, spine0_(0)
+		{
+			ASSERT(length > 0);
+			*binroot_ = bin_t::to_root(length);
+
+			u64 const binmap_size = binmap_size_for(length_);
 			binmap0_ = binmap1_ + binmap_size;
+
+			update_spine();
+		}
+
+
+		/**
+		* Size of the data that a binmap with this root requires
+		*/
+		u64 binmap::size_for(bin_t _root)
+		{
+			return data_size_for(_root);
+		}
+
+		/**
+		* Size of the data that an exact-length binmap requires
+		*/
+		u64 binmap::size_for(u64 _length)
+		{
+			return data_size_for(_length);
+		}
+
+
+		/**
+		* Generate the peak bins, the roots of the sub-trees that cover exactly length() base bins
+		*/
+		s32 binmap::peaks(bin_t* _peaks) const
+		{
+			return gen_peaks(length_, _peaks);
+		}
+
+
+		/**
+		* Value of a bin that is past the end, bins completely past the end have the @padding value
+		*/
+		bool binmap::read_past_end(bin_t _bin, u64 _spine, bool _padding) const
+		{
+			if (_bin.base_offset() >= length_)
+				return _padding;
+			return ((_spine >> _bin.layer()) & 1) != 0;
+		}
+
+		void binmap::write_past_end(bin_t _bin, u64& _spine, bool _in_value)
+		{
+			if (_bin.base_offset() >= length_)
+				return;
+			u64 const bit = (u64)1 << _bin.layer();
+			if (_in_value) _spine = _spine | bit;
+			else _spine = _spine & ~bit;
+		}
+
+		/**
+		* The accessors of the algorithms, for an exact-length binmap the bins past the end are
+		* kept in the spine (or read as padding), otherwise these are the plain bit accessors
+		*/
+		template <bool Exact>
+		inline bool binmap::read_am(bin_t _bin) const
+		{
+			if (Exact && straddles_end(_bin))
+				return read_past_end(_bin, spine1_, true);
+			return read_am_at(_bin);
+		}
+
+		template <bool Exact>
+		inline bool binmap::read_om(bin_t _bin) const
+		{
+			if (Exact && straddles_end(_bin))
+				return read_past_end(_bin, spine0_, false);
+			return read_om_at(_bin);
+		}
+
+		template <bool Exact>
+		inline void binmap::write_am(bin_t _bin, bool _in_value)
+		{
+			if (Exact && straddles_end(_bin))
+				write_past_end(_bin, spine1_, _in_value);
+			else
+				write_am_at(_bin, _in_value);
+		}
+
+		template <bool Exact>
+		inline void binmap::write_om(bin_t _bin, bool _in_value)
+		{
+			if (Exact && straddles_end(_bin))
+				write_past_end(_bin, spine0_, _in_value);
+			else
+				write_om_at(_bin, _in_value);
+		}
+
+		template <bool Exact>
+		inline bool binmap::xchg_am(bin_t _bin, bool _in_value)
+		{
+			if (Exact && straddles_end(_bin))
+			{
+				bool const old_value = read_past_end(_bin, spine1_, true);
+				write_past_end(_bin, spine1_, _in_value);
+				return old_value;
+			}
+			return xchg_am_at(_bin, _in_value);
+		}
+
+		template <bool Exact>
+		inline bool binmap::xchg_om(bin_t _bin, bool _in_value)
+		{
+			if (Exact && straddles_end(_bin))
+			{
+				bool const old_value = read_past_end(_bin, spine0_, false);
+				write_past_end(_bin, spine0_, _in_value);
+				return old_value;
+			}
+			return xchg_om_at(_bin, _in_value);
+		}
+
+		/**
+		* Whether the sub-tree of bin_ is completely filled (or completely empty)
+		*/
+		template <bool Exact>
+		inline bool binmap::is_solid_at(bin_t _bin, bool _filled) const
+		{
+			return _filled ? read_am<Exact>(_bin) : !read_om<Exact>(_bin);
+		}
+
+		/**
+		* Return the largest bin that has the same base offset and is not past the end
+		*/
+		bin_t binmap::clip_to_end(bin_t _bin) const
+		{
+			while (straddles_end(_bin))
+				_bin.to_left();
+			return _bin;
+		}
+
+		/**
+		* Compute the bins that straddle the end from the (stored) bins below them
+		*/
+		void binmap::update_spine()
+		{
+			spine1_ = 0;
+			spine0_ = 0;
+
+			s32 const root_layer = binroot_->layer();
+			for (s32 l = 1; l <= root_layer; ++l)
+			{
+				bin_t const b(l, (length_ - 1) >> l);
+				if (!straddles_end(b))
+					continue;
+				write_am<true>(b, read_am<true>(b.left()) && read_am<true>(b.right()));
+				write_om<true>(b, read_om<true>(b.left()) || read_om<true>(b.right()));
+			}
 		}
 
 
@@ -38,8 +223,7 @@ namespace ncore
 		*/
 		bool binmap::is_empty() const
 		{
-			bool const r = read_om_at(*binroot_);
-			return !r;
+			return is_empty(*binroot_);
 		}
 
 
@@ -57,16 +241,9 @@ namespace ncore
 		*/
 		bool binmap::is_empty(const bin_t& bin) const
 		{
-			bool r = false;
-			if (bin == bin_t::ALL)
-			{
-				r = read_om_at(*binroot_);
-			}
-			else
-			{
-				ASSERT(binroot_->contains(bin));
-				r = read_om_at(bin);
-			}
+			bin_t const b = (bin == bin_t::ALL) ? *binroot_ : bin;
+			ASSERT(binroot_->contains(b));
+			bool const r = is_exact() ? read_om<true>(b) : read_om_at(b);
 			return !r;
 		}
 
@@ -76,17 +253,9 @@ namespace ncore
 		*/
 		bool binmap::is_filled(const bin_t& bin) const
 		{
-			bool v = false;
-			if (bin == bin_t::ALL)
-			{
-				v = read_am_at(*binroot_);
-			}
-			else
-			{
-				ASSERT(binroot_->contains(bin));
-				v = read_am_at(bin);
-			}
-			return v;
+			bin_t const b = (bin == bin_t::ALL) ? *binroot_ : bin;
+			ASSERT(binroot_->contains(b));
+			return is_exact() ? read_am<true>(b) : read_am_at(b);
 		}
 
 
@@ -94,16 +263,24 @@ namespace ncore
 		* Return the topmost solid bin which covers the specified bin
 		*/
 		bin_t binmap::cover(const bin_t& bin) const
+		{
+			return is_exact() ? cover_at<true>(bin) : cover_at<false>(bin);
+		}
+
+		template <bool Exact>
+		bin_t binmap::cover_at(bin_t bin) const
 		{
 			bin_t i(bin);
-			bool v = read_am_at(i);
+			bool v = read_am<Exact>(i);
 			if (!v)
 				return i;
 
 			while (i != *binroot_)
 			{
 				bin_t p = i.parent();
-				v = read_am_at(p);
+				if (Exact && straddles_end(p))
+					break;
+				v = read_am<Exact>(p);
 				if (!v)
 					break;
 				i = p;
@@ -125,9 +302,15 @@ namespace ncore
 		* Find first filled bin
 		*/
 		bin_t binmap::find_filled() const
+		{
+			return is_exact() ? find_filled_at<true>() : find_filled_at<false>();
+		}
+
+		template <bool Exact>
+		bin_t binmap::find_filled_at() const
 		{
 			// Can we can find a filled bin in this sub-tree?
-			if (read_om_at(*binroot_)==false)
+			if (read_om<Exact>(*binroot_)==false)
 				return bin_t::NONE;
 
 			bin_t i(*binroot_);
@@ -135,10 +318,10 @@ namespace ncore
 			while (l >= 0)
 			{
 				bin_t c = i.left();
-				if (read_om_at(c) == false)
+				if (read_om<Exact>(c) == false)
 				{
 					c = i.right();
-					ASSERT(read_om_at(c) == true);
+					ASSERT(read_om<Exact>(c) == true);
 				}
 				i = c;
 				--l;
@@ -159,8 +342,18 @@ namespace ncore
 			{
 				return bin_t::NONE;
 			}
+			return is_exact() ? find_empty_at<true>(start) : find_empty_at<false>(start);
+		}
 
-			if (read_am_at(*binroot_))
+		template <bool Exact>
+		bin_t binmap::find_empty_at(bin_t start) const
+		{
+			if (Exact && start.base_offset() >= length_)
+			{
+				return bin_t::NONE;
+			}
+
+			if (read_am<Exact>(*binroot_))
 			{	// full, impossible to find an empty bin
 				return bin_t::NONE;
 			}
@@ -171,16 +364,16 @@ namespace ncore
 			// when going up check if base_left() is still right or equal to the start bin
 			do
 			{
-				if (read_om_at(i) == false)
-					return i;
+				if (read_om<Exact>(i) == false)
+					return Exact ? clip_to_end(i) : i;
 
 				// Does this sub-tree has a possible empty bin ?
-				if (read_am_at(i) == false)
+				if (read_am<Exact>(i) == false)
 					break;
 
 				// traverse horizontally
 				i = bin_t(layer, i.layer_offset() + 1);
-				if (!binroot_->contains(i))
+				if (!binroot_->contains(i) || (Exact && i.base_offset() >= length_))
 					return bin_t::NONE;
 
 				bin_t const parent = i.parent();
@@ -197,14 +390,14 @@ namespace ncore
 			{
 				// we can early out when the OR binmap is indicating that
 				// the bin (and sub-tree) is empty.
-				if (read_om_at(i) == false)
-					return i;
+				if (read_om<Exact>(i) == false)
+					return Exact ? clip_to_end(i) : i;
 
 				bin_t c = i.left();
-				if (read_am_at(c) == true)
+				if (read_am<Exact>(c) == true)
 				{
 					c = i.right();
-					ASSERT(read_am_at(c) == false);
+					ASSERT(read_am<Exact>(c) == false);
 				}
 				i = c;
 				--layer;
@@ -213,6 +406,162 @@ namespace ncore
 			return bin_t::NONE;
 		}
 
+		/**
+		* Find the first run of at least min_length empty base bins starting at or after base offset 'from'.
+		* Returns the first base bin of that run, or NONE when there is no such run.
+		*/
+		bin_t binmap::find_empty_run(u64 min_length, u64 from) const
+		{
+			return is_exact() ? find_run<true>(min_length, from, false) : find_run<false>(min_length, from, false);
+		}
+
+
+		/**
+		* Find the first run of at least min_length filled base bins starting at or after base offset 'from'.
+		* Returns the first base bin of that run, or NONE when there is no such run.
+		*/
+		bin_t binmap::find_filled_run(u64 min_length, u64 from) const
+		{
+			return is_exact() ? find_run<true>(min_length, from, true) : find_run<false>(min_length, from, true);
+		}
+
+
+		/**
+		* Find the first solid bin at @layer with a base offset right of @from (inclusive).
+		* Sub-trees that are solid with the opposite value are skipped as a whole.
+		*/
+		template <bool Exact>
+		bin_t binmap::find_solid_at_layer(s32 layer, u64 from, bool filled) const
+		{
+			u64 const end = binroot_->base_offset() + length_;
+			u64 const len = (u64)1 << layer;
+
+			u64 o = (from + len - 1) >> layer;
+			while ((o << layer) < end)
+			{
+				bin_t b(layer, o);
+				if (is_solid_at<Exact>(b, filled))
+					return b;
+
+				if (is_solid_at<Exact>(b, !filled))
+				{
+					// skip the largest sub-tree that cannot contain a solid bin
+					while (b != *binroot_ && is_solid_at<Exact>(b.parent(), !filled))
+						b.to_parent();
+					o = (b.base_offset() + b.base_length()) >> layer;
+				}
+				else
+				{
+					++o;
+				}
+			}
+			return bin_t::NONE;
+		}
+
+
+		/**
+		* Count the solid base bins directly left of base @offset, not going below base @floor
+		* (the trailing count of the sub-trees left of @offset).
+		*/
+		template <bool Exact>
+		u64 binmap::solid_length_left(u64 offset, u64 floor, bool filled) const
+		{
+			u64 n = 0;
+			while (offset > floor)
+			{
+				bin_t b(0, offset - 1);
+				if (!is_solid_at<Exact>(b, filled))
+					break;
+
+				while (b != *binroot_ && b.is_right() && is_solid_at<Exact>(b.parent(), filled))
+					b.to_parent();
+
+				u64 len = b.base_length();
+				if (len > (offset - floor))
+					len = offset - floor;
+				n += len;
+				offset -= len;
+			}
+			return n;
+		}
+
+
+		/**
+		* Count the solid base bins starting at base @offset, not going beyond base @ceiling
+		* (the leading count of the sub-trees right of @offset). Stops as soon as @need is reached.
+		*/
+		template <bool Exact>
+		u64 binmap::solid_length_right(u64 offset, u64 ceiling, u64 need, bool filled) const
+		{
+			u64 n = 0;
+			while (offset < ceiling && n < need)
+			{
+				bin_t b(0, offset);
+				if (!is_solid_at<Exact>(b, filled))
+					break;
+
+				while (b != *binroot_ && b.is_left() && is_solid_at<Exact>(b.parent(), filled))
+					b.to_parent();
+
+				u64 len = b.base_length();
+				if (len > (ceiling - offset))
+					len = ceiling - offset;
+				n += len;
+				offset += len;
+			}
+			return n;
+		}
+
+
+		/**
+		* Find the first run of at least min_length solid base bins right of @from (inclusive).
+		*
+		* Any run of length N fully contains an aligned solid bin at layer k, where k is the
+		* highest layer for which (2^(k+1) - 1) <= N. So we only search for solid bins at
+		* that layer, which lets us skip every sub-tree that cannot hold the run. From such
+		* a candidate the run is measured by combining the trailing solid count of the
+		* sub-trees on the left with the leading solid count of the sub-trees on the right.
+		*/
+		template <bool Exact>
+		bin_t binmap::find_run(u64 min_length, u64 from, bool filled) const
+		{
+			if (binroot_ == nullptr)
+				return bin_t::NONE;
+
+			if (min_length == 0)
+				min_length = 1;
+
+			u64 const begin = binroot_->base_offset();
+			u64 const end   = begin + length_;
+			if (from < begin)
+				from = begin;
+			if (from >= end || min_length > (end - from))
+				return bin_t::NONE;
+
+			s32 layer = 0;
+			while (((u64)4 << layer) - 1 <= min_length)
+				++layer;
+
+			// Note: every base bin left of @p is either before @from or is known to end a run
+			u64 p = from;
+			while (min_length <= (end - p))
+			{
+				bin_t const c = find_solid_at_layer<Exact>(layer, p, filled);
+				if (c.is_none())
+					break;
+
+				u64 const cs    = c.base_offset();
+				u64 const left  = solid_length_left<Exact>(cs, p, filled);
+				u64 const right = solid_length_right<Exact>(cs, end, min_length - left, filled);
+				if ((left + right) >= min_length)
+					return bin_t(0, cs - left);
+
+				// the base bin at (cs + right) is not solid, continue right of it
+				p = cs + right + 1;
+			}
+			return bin_t::NONE;
+		}
+
 		/**
 		* Find first additional bin in source
 		*
@@ -233,19 +582,23 @@ namespace ncore
 			ASSERT(source.root() == destination.root());
 
 			// Brute Force
-			s32 const lbo = (s32)(range.base_left().layer_offset());
-			s32 const n = (s32)(range.base_length());
+			u64 const lbo = range.base_left().layer_offset();
+			u64 const n = range.base_length();
 
-			for (s32 i=0; i<n; ++i)
+			for (u64 i=0; i<n; ++i)
 			{
 				bin_t b(0, lbo + i);
-				if (source.read_am_at(b)==true && destination.read_am_at(b)==false)
+				if (source.is_past_end(b))
+					break;
+				if (source.is_filled(b) && !destination.is_filled(b))
 				{
 					// up
 					while (b != source.root())
 					{
 						bin_t p = b.parent();
-						if (source.read_am_at(p)==true && destination.read_om_at(p)==false)
+						if (source.is_past_end(p))
+							break;
+						if (source.is_filled(p) && destination.is_empty(p))
 						{
 							b = p;
 						}
@@ -278,128 +631,149 @@ namespace ncore
 			}
 			else if (binroot_->contains(bin))
 			{
-				const u32 root_layer = binroot_->layer();
-				const u32 bin_layer  = (root_layer>0) ? bin.layer() : 0;
+				if (is_exact())
+					set_at<true>(bin);
+				else
+					set_at<false>(bin);
+			}
+		}
+
+		template <bool Exact>
+		void binmap::set_at(bin_t bin)
+		{
+			// nothing is stored for bins that are completely past the end
+			if (Exact && bin.base_offset() >= length_)
+				return;
 
-				// check if this action is changing the value to begin with
-				// if not we can do an early-out
+			const u32 root_layer = binroot_->layer();
+			const u32 bin_layer  = (root_layer>0) ? bin.layer() : 0;
 
-				// binmap0_
+			// check if this action is changing the value to begin with
+			// if not we can do an early-out
+
+			// binmap0_
+			{
+				if (xchg_om<Exact>(bin, true) == false)
 				{
-					if (xchg_om_at(bin, true) == false)
+					bin_t ib = bin;
+					u32 ib_layer = bin_layer;
+					do
 					{
-						bin_t ib = bin;
-						u32 ib_layer = bin_layer;
-						do
-						{
-							ib.to_parent();
-							++ib_layer;
+						ib.to_parent();
+						++ib_layer;
 
-							bool const oiv = xchg_om_at(ib, true);
-							if (true == oiv)
-								break;
+						bool const oiv = xchg_om<Exact>(ib, true);
+						if (true == oiv)
+							break;
 
-						} while (ib_layer < root_layer);
-					}
+					} while (ib_layer < root_layer);
+				}
 
-					if (bin_layer > 0)
-					{
-						// fill the range
-						bin_t il = bin.base_left();
-						bin_t ir = bin.base_right();
+				if (bin_layer > 0)
+				{
+					// fill the range
+					bin_t il = bin.base_left();
+					bin_t ir = (Exact && straddles_end(bin)) ? bin_t(0, length_ - 1) : bin.base_right();
 
-						// determine start, end and length
-						u32 const lo = (u32)(il.value() >> 3);
-						u32 const ro = (u32)(ir.value() >> 3);
+					// determine start, end and length
+					u64 const lo = il.value() >> 3;
+					u64 const ro = ir.value() >> 3;
 
-						u8 const lm = 0xFF >> (il.value() & 0x07);
-						u8 const rm = (u8)(0xFF80 >> (ir.value() & 0x07));
+					u8 const lm = 0xFF >> (il.value() & 0x07);
+					u8 const rm = (u8)(0xFF80 >> (ir.value() & 0x07));
 
+					{
+						u8* lb = binmap0_ + lo;
+						u8* rb = binmap0_ + ro;
+
+						s64 const d = (s64)(ro - lo);
+						if (d == 0)
+						{
+							*lb = *lb | (lm & rm);
+						}
+						else if (d == 1)
 						{
-							u8* lb = binmap0_ + lo;
-							u8* rb = binmap0_ + ro;
-
-							s32 const d = ro - lo;
-							if (d == 0)
-							{
-								*lb = *lb | (lm & rm);
-							}
-							else if (d == 1)
-							{
-								*lb = *lb | lm;
-								*rb = *rb | rm;
-							}
-							else
-							{
-								*lb = *lb | lm;
-								++lb;
-								while (lb < rb)
-									*lb++ = 0xff;
-								*rb = *rb | rm;
-							}
+							*lb = *lb | lm;
+							*rb = *rb | rm;
+						}
+						else
+						{
+							*lb = *lb | lm;
+							++lb;
+							while (lb < rb)
+								*lb++ = 0xff;
+							*rb = *rb | rm;
 						}
 					}
 				}
+			}
 
-				// binmap1_
-				{
+			// binmap1_
+			{
 
-					if (!xchg_am_at(bin, true))
+				if (!xchg_am<Exact>(bin, true))
+				{
+					u32 ib_layer = bin_layer;
+					bin_t ib = bin;
+					bool iv = true;
+					while (ib_layer < root_layer)
 					{
-						u32 ib_layer = bin_layer;
-						bin_t ib = bin;
-						bool iv = true;
-						while (ib_layer < root_layer)
-						{
-							bool const sv = read_am_at(ib.sibling());
-							iv = (iv && sv);
-							ib.to_parent();
-							++ib_layer;
-
-							bool const oiv = xchg_am_at(ib, iv);
-							if (oiv == iv)
-								break;
-						};
-					}
+						bool const sv = read_am<Exact>(ib.sibling());
+						iv = (iv && sv);
+						ib.to_parent();
+						++ib_layer;
 
-					if (bin_layer > 0)
-					{
-						// fill the range
-						bin_t il = bin.base_left();
-						bin_t ir = bin.base_right();
+						bool const oiv = xchg_am<Exact>(ib, iv);
+						if (oiv == iv)
+							break;
+					};
+				}
+
+				if (bin_layer > 0)
+				{
+					// fill the range
+					bin_t il = bin.base_left();
+					bin_t ir = (Exact && straddles_end(bin)) ? bin_t(0, length_ - 1) : bin.base_right();
 
-						// determine start, end and length
-						u32 const lo = (u32)(il.value() >> 3);
-						u32 const ro = (u32)(ir.value() >> 3);
+					// determine start, end and length
+					u64 const lo = il.value() >> 3;
+					u64 const ro = ir.value() >> 3;
 
-						u8 const lm = 0xFF >> (il.value() & 0x07);
-						u8 const rm = (u8)(0xFF80 >> (ir.value() & 0x07));
+					u8 const lm = 0xFF >> (il.value() & 0x07);
+					u8 const rm = (u8)(0xFF80 >> (ir.value() & 0x07));
 
+					{
+						u8* lb = binmap1_ + lo;
+						u8* rb = binmap1_ + ro;
+						s64 const d = (s64)(ro - lo);
+						if (d == 0)
+						{
+							*lb = *lb | (lm & rm);
+						}
+						else if (d == 1)
 						{
-							u8* lb = binmap1_ + lo;
-							u8* rb = binmap1_ + ro;
-							s32 const d = ro - lo;
-							if (d == 0)
-							{
-								*lb = *lb | (lm & rm);
-							}
-							else if (d == 1)
-							{
-								*lb = *lb | lm;
-								*rb = *rb | rm;
-							}
-							else
-							{
-								*lb = *lb | lm;
-								++lb;
-								while (lb < rb)
-									*lb++ = 0xff;
-								*rb = *rb | rm;
-							}
+							*lb = *lb | lm;
+							*rb = *rb | rm;
+						}
+						else
+						{
+							*lb = *lb | lm;
+							++lb;
+							while (lb < rb)
+								*lb++ = 0xff;
+							*rb = *rb | rm;
 						}
 					}
 				}
 			}
+
+			// the bins inside this bin that straddle the end are kept in the spine
+			if (Exact && straddles_end(bin))
+			{
+				u64 const layers = ((u64)2 << bin.layer()) - 1;
+				spine1_ = spine1_ | layers;
+				spine0_ = spine0_ | layers;
+			}
 		}
 
 
@@ -420,128 +794,215 @@ namespace ncore
 			}
 			else if (binroot_->contains(bin))
 			{
-				const u32 root_layer = binroot_->layer();
-				const u32 bin_layer  = (root_layer>0) ? bin.layer() : 0;
+				if (is_exact())
+					reset_at<true>(bin);
+				else
+					reset_at<false>(bin);
+			}
+		}
+
+		template <bool Exact>
+		void binmap::reset_at(bin_t bin)
+		{
+			// nothing is stored for bins that are completely past the end
+			if (Exact && bin.base_offset() >= length_)
+				return;
 
-				// check if this action is changing the value to begin with
-				// if not we can do an early-out
+			const u32 root_layer = binroot_->layer();
+			const u32 bin_layer  = (root_layer>0) ? bin.layer() : 0;
 
-				// binmap0_
+			// check if this action is changing the value to begin with
+			// if not we can do an early-out
+
+			// binmap0_
+			{
+				if (xchg_om<Exact>(bin, false))
 				{
-					if (xchg_om_at(bin, false))
+					bin_t ib = bin;
+					u32 ib_layer = bin_layer;
+					while (ib_layer < root_layer)
 					{
-						bin_t ib = bin;
-						u32 ib_layer = bin_layer;
-						while (ib_layer < root_layer)
-						{
-							bool sv = read_om_at(ib.sibling());
-							if (sv)
-								break;
-
-							ib.to_parent();
-							++ib_layer;
-							bool const oiv = xchg_om_at(ib, false);
-							if (oiv == false)
-								break;
-						};
-					}
+						bool sv = read_om<Exact>(ib.sibling());
+						if (sv)
+							break;
 
-					if (bin_layer > 0)
-					{
-						// clear the range
-						bin_t il = bin.base_left();
-						bin_t ir = bin.base_right();
+						ib.to_parent();
+						++ib_layer;
+						bool const oiv = xchg_om<Exact>(ib, false);
+						if (oiv == false)
+							break;
+					};
+				}
 
-						// determine start, end and length
-						u32 const llo = (u32)(il.value() >> 3);
-						u32 const lro = (u32)(ir.value() >> 3);
+				if (bin_layer > 0)
+				{
+					// clear the range
+					bin_t il = bin.base_left();
+					bin_t ir = (Exact && straddles_end(bin)) ? bin_t(0, length_ - 1) : bin.base_right();
 
-						u8 const lm = (u8)(0xFF00 >> (il.value() & 0x07));
-						u8 const rm = 0x7F >> (ir.value() & 0x07);
+					// determine start, end and length
+					u64 const llo = il.value() >> 3;
+					u64 const lro = ir.value() >> 3;
 
+					u8 const lm = (u8)(0xFF00 >> (il.value() & 0x07));
+					u8 const rm = 0x7F >> (ir.value() & 0x07);
+
+					{
+						u8* lb = binmap0_ + llo;
+						u8* rb = binmap0_ + lro;
+
+						s64 const d = (s64)(rb - lb);
+						if (d == 0)
 						{
-							u8* lb = binmap0_ + llo;
-							u8* rb = binmap0_ + lro;
-
-							s32 const d = (s32)(rb - lb);
-							if (d == 0)
-							{
-								*lb = *lb & (lm | rm);
-							}
-							else if (d == 1)
-							{
-								*lb = *lb & lm;
-								*rb = *rb & rm;
-							}
-							else
-							{
-								*lb = *lb & lm;
-								++lb;
-								while (lb < rb)
-									*lb++ = 0;
-								*rb = *rb & rm;
-							}
+							*lb = *lb & (lm | rm);
+						}
+						else if (d == 1)
+						{
+							*lb = *lb & lm;
+							*rb = *rb & rm;
+						}
+						else
+						{
+							*lb = *lb & lm;
+							++lb;
+							while (lb < rb)
+								*lb++ = 0;
+							*rb = *rb & rm;
 						}
 					}
 				}
+			}
 
-				// check if this action is changing the value to begin with
-				// if not we can do an early-out
-				// binmap1_
+			// check if this action is changing the value to begin with
+			// if not we can do an early-out
+			// binmap1_
+			{
+				if (xchg_am<Exact>(bin, false))
 				{
-					if (xchg_am_at(bin, false))
+					bin_t ib = bin;
+					u32 ib_layer = bin_layer;
+					while (ib_layer < root_layer)
 					{
-						bin_t ib = bin;
-						u32 ib_layer = bin_layer;
-						while (ib_layer < root_layer)
-						{
-							ib.to_parent();
-							++ib_layer;
-							bool const oiv = xchg_am_at(ib, false);
-							if (oiv == false)
-								break;
-						};
-					}
+						ib.to_parent();
+						++ib_layer;
+						bool const oiv = xchg_am<Exact>(ib, false);
+						if (oiv == false)
+							break;
+					};
+				}
 
-					if (bin_layer > 0)
-					{
-						// clear the range
-						bin_t il = bin.base_left();
-						bin_t ir = bin.base_right();
+				if (bin_layer > 0)
+				{
+					// clear the range
+					bin_t il = bin.base_left();
+					bin_t ir = (Exact && straddles_end(bin)) ? bin_t(0, length_ - 1) : bin.base_right();
 
-						// determine start, end and length
-						u32 const llo = (u32)(il.value() >> 3);
-						u32 const lro = (u32)(ir.value() >> 3);
+					// determine start, end and length
+					u64 const llo = il.value() >> 3;
+					u64 const lro = ir.value() >> 3;
 
-						u8 const lm = (u8)(0xFF00 >> (il.value() & 0x07));
-						u8 const rm = 0x7F >> (ir.value() & 0x07);
+					u8 const lm = (u8)(0xFF00 >> (il.value() & 0x07));
+					u8 const rm = 0x7F >> (ir.value() & 0x07);
 
+					{
+						u8* lb = binmap1_ + llo;
+						u8* rb = binmap1_ + lro;
+
+						s64 const d = (s64)(rb - lb);
+						if (d == 0)
+						{
+							*lb = *lb & (lm | rm);
+						}
+						else if (d == 1)
+						{
+							*lb = *lb & lm;
+							*rb = *rb & rm;
+						}
+						else
 						{
-							u8* lb = binmap1_ + llo;
-							u8* rb = binmap1_ + lro;
-
-							s32 const d = (s32)(rb - lb);
-							if (d == 0)
-							{
-								*lb = *lb & (lm | rm);
-							}
-							else if (d == 1)
-							{
-								*lb = *lb & lm;
-								*rb = *rb & rm;
-							}
-							else
-							{
-								*lb = *lb & lm;
-								++lb;
-								while (lb < rb)
-									*lb++ = 0;
-								*rb = *rb & rm;
-							}
+							*lb = *lb & lm;
+							++lb;
+							while (lb < rb)
+								*lb++ = 0;
+							*rb = *rb & rm;
 						}
 					}
 				}
 			}
+
+			// the bins inside this bin that straddle the end are kept in the spine
+			if (Exact && straddles_end(bin))
+			{
+				u64 const layers = ((u64)2 << bin.layer()) - 1;
+				spine1_ = spine1_ & ~layers;
+				spine0_ = spine0_ & ~layers;
+			}
+		}
+
+
+		/**
+		* Grow the binmap to a larger root.
+		*
+		* With the in-order layout a root that starts at base offset 0 is the left-most
+		* sub-tree of every larger root, so all existing bins keep their bit position and
+		* growing only has to move the OR binmap and clear the new part of the tree.
+		* @data must be of size_for(root) and may be the current data when it is large enough,
+		* doubling the root like this costs amortized O(1) per bin.
+		*/
+		void binmap::grow(bin_t root, byte* data)
+		{
+			bin_t const old_root = *binroot_;
+			ASSERT(length_ == old_root.base_length());
+			ASSERT(root.contains(old_root));
+			ASSERT(root.base_offset() == old_root.base_offset());
+			if (root == old_root)
+				return;
+
+			u64 const old_size = binmap_size_for(old_root.base_length());
+			u64 const new_size = binmap_size_for(root.base_length());
+
+			u8* const binmap1 = data + sizeof(bin_t);
+			u8* const binmap0 = binmap1 + new_size;
+
+			// move the OR binmap first, when growing in-place it moves to a higher address
+			// and overlaps the old OR binmap, so copy backwards
+			for (u64 i = old_size; i > 0; --i)
+				binmap0[i - 1] = binmap0_[i - 1];
+			if (binmap1 != binmap1_)
+			{
+				for (u64 i = 0; i < old_size; ++i)
+					binmap1[i] = binmap1_[i];
+			}
+			g_memclr(binmap1 + old_size, new_size - old_size);
+			g_memclr(binmap0 + old_size, new_size - old_size);
+
+			binroot_ = (bin_t*)data;
+			binmap1_ = binmap1;
+			binmap0_ = binmap0;
+			length_  = root.base_length();
+			*binroot_ = root;
+
+			// bins in the last byte that are outside the old root are not part of the old binmap
+			bin_t::uint_t const old_end = old_root.base_right().value() + 1;
+			bin_t::uint_t       new_end = root.base_right().value() + 1;
+			if (new_end > ((bin_t::uint_t)old_size * 8))
+				new_end = ((bin_t::uint_t)old_size * 8);
+			for (bin_t::uint_t v = old_end; v < new_end; ++v)
+			{
+				write_am_at(bin_t(v), false);
+				write_om_at(bin_t(v), false);
+			}
+
+			// the new right sub-trees are empty, so the ancestors of the old root
+			// are not filled and only non-empty when the old root is not empty
+			bool const om = read_om_at(old_root);
+			bin_t ib = old_root;
+			while (ib != root)
+			{
+				ib.to_parent();
+				write_am_at(ib, false);
+				write_om_at(ib, om);
+			}
 		}
 
 
@@ -550,9 +1011,11 @@ namespace ncore
 		*/
 		void binmap::clear()
 		{
-			u32 const binmap_size = (u32)(((binroot_->base_length() * 2) + 7) / 8);
+			u64 const binmap_size = binmap_size_for(length_);
 			g_memclr(binmap1_, binmap_size);
 			g_memclr(binmap0_, binmap_size);
+			spine1_ = 0;
+			spine0_ = 0;
 		}
 
 
@@ -561,17 +1024,19 @@ namespace ncore
 		*/
 		void binmap::fill()
 		{
-			u32 const binmap_size = (u32)(((binroot_->base_length() * 2) + 7) / 8);
+			u64 const binmap_size = binmap_size_for(length_);
 			g_memset(binmap1_, 0xffffffff, binmap_size);
 			g_memset(binmap0_, 0xffffffff, binmap_size);
+			spine1_ = ~(u64)0;
+			spine0_ = ~(u64)0;
 		}
 
 		/**
 		* Get total size of the binmap
 		*/
-		uint_t binmap::total_size() const
+		u64 binmap::total_size() const
 		{
-			u32 const binmap_size = (u32)(((binroot_->base_length() * 2) + 7) / 8);
+			u64 const binmap_size = binmap_size_for(length_);
 			return sizeof(binmap) + binmap_size + binmap_size;
 		}
 
@@ -580,21 +1045,21 @@ namespace ncore
 		*/
 		void copy(binmap& destination, const binmap& source, const bin_t& range)
 		{
-			if (!source.read_om_at(range))
+			if (source.is_empty(range))
 			{
 				destination.reset(range);
 			}
-			else if (source.read_am_at(range))
+			else if (source.is_filled(range))
 			{
 				destination.set(range);
 			}
 			else
 			{
-				s32 const e = (s32)(range.base_offset() + range.base_length());
-				for (s32 i=(s32)range.base_offset(); i<e; ++i)
+				u64 const e = range.base_offset() + range.base_length();
+				for (u64 i=range.base_offset(); i<e; ++i)
 				{
 					bin_t const b(0, i);
-					bool const v = source.read_am_at(b);
+					bool const v = source.is_filled(b);
 					if (v) destination.set(b);
 					else destination.reset(b);
 				}
@@ -3,21 +3,26 @@
 #include "cbase/c_memory.h"
 
 #include "cbinmaps/c_merkle.h"
+#include "cbinmaps/c_utils.h"
 
 namespace ncore
 {
 	namespace merkle
 	{
-		static inline bool is_zero(hash_t const& _src)
+		bool	is_zero   (hash_t const& _src)
 		{
+			// no early exit, or-reduce the words
 			u32 const* src = (u32 const*)_src.digest_;
 			u32 const* end = (u32 const*)(_src.digest_ + _src.length_);
-			bool is_empty = *src++ == 0;
-			while (is_empty && src<end)
-			{
-				is_empty = (0 == *src++);
-			}
-			return is_empty;
+			u32 bits = 0;
+			while (src < end)
+				bits |= *src++;
+			return bits == 0;
+		}
+
+		static inline u32 load_be32(u8 const* _p)
+		{
+			return ((u32)_p[0] << 24) | ((u32)_p[1] << 16) | ((u32)_p[2] << 8) | (u32)_p[3];
 		}
 
 		static inline void copy(hash_t& _dst, hash_t const& _src)
@@ -34,34 +39,20 @@ namespace ncore
 			ASSERT(_a.digest_ != nullptr);
 			ASSERT(_b.digest_ != nullptr);
 
-			// This is a special case where we assume the signature is aligned on 4 bytes
+			// This is a special case where we assume the signature is aligned on 4 bytes,
+			// no early exit, xor/or-reduce the words
 			u32 const* lhs = (u32 const*)_a.digest_;
 			u32 const* rhs = (u32 const*)_b.digest_;
 			u32 const* end = (u32 const*)(_b.digest_ + _b.length_);
-			bool equal = (*lhs++ == *rhs++);
-			while (equal && rhs<end)
-			{
-				equal = (*lhs++ == *rhs++);
-			}
-			return equal;
+			u32 diff = 0;
+			while (rhs < end)
+				diff |= *lhs++ ^ *rhs++;
+			return diff == 0;
 		}
 
 		bool	are_nequal (hash_t const& _a, hash_t const& _b)
 		{
-			ASSERT(_a.length_ == _b.length_);
-			ASSERT(_a.digest_ != nullptr);
-			ASSERT(_b.digest_ != nullptr);
-
-			// This is a special case where we assume the signature is aligned on 4 bytes
-			u32 const* lhs = (u32 const*)_a.digest_;
-			u32 const* rhs = (u32 const*)_b.digest_;
-			u32 const* end = (u32 const*)(_b.digest_ + _b.length_);
-			bool equal = (*lhs++ == *rhs++);
-			while (equal && rhs<end)
-			{
-				equal = (*lhs++ == *rhs++);
-			}
-			return equal;
+			return !are_equal(_a, _b);
 		}
 
 		s32		compare(const hash_t& _a, const hash_t& _b)
@@ -70,18 +61,19 @@ namespace ncore
 			ASSERT(_a.digest_ != nullptr);
 			ASSERT(_b.digest_ != nullptr);
 
-			// This is a special case where we assume the signature is aligned on 4 bytes
+			// This is a special case where we assume the signature length is a multiple of 4 bytes,
+			// comparing big-endian words is the same as comparing the bytes lexicographically
 			u8 const* lhs = (u8 const*)(_a.digest_);
 			u8 const* end = (u8 const*)(_a.digest_ + _a.length_);
 			u8 const* rhs = (u8 const*)(_b.digest_);
 			while (lhs < end)
 			{
-				if (*lhs < *rhs)
-					return -1;
-				else if (*lhs > *rhs)
-					return 1;
-				++lhs;
-				++rhs;
+				u32 const l = load_be32(lhs);
+				u32 const r = load_be32(rhs);
+				if (l != r)
+					return l < r ? -1 : 1;
+				lhs += 4;
+				rhs += 4;
 			}
 			return 0;
 		}
@@ -112,20 +104,93 @@ namespace ncore
 			}
 		}
 
-		u32	data_t::size_for(bin_t _root, u32 _siglen)
+		u64	data_t::size_for(bin_t _root, u32 _siglen)
 		{
-			u32 const data_size = (u32)((_root.base_length() * 2 * _siglen) + sizeof(bin_t));
+			u64 const data_size = (_root.base_length() * 2 * _siglen) + sizeof(bin_t);
 			return data_size;
 		}
 
+		sparse_t::sparse_t(bin_t _root, u32 _siglen, u32 _slots, u8* _data, binmaps::binmap* _present)
+			: root_(_root)
+			, siglen_(_siglen)
+			, mask_(_slots - 1)
+			, shift_(64)
+			, count_(0)
+			, max_count_(_slots - (_slots / 4))
+			, keys_((u64*)_data)
+			, digests_(_data + ((u64)_slots * sizeof(u64)))
+			, present_(_present)
+		{
+			ASSERT(_slots >= 4 && (_slots & (_slots - 1)) == 0);
+			ASSERT(_present->root().contains(bin_t(0, _root.base_right().value())));
+			for (u32 s = _slots; s > 1; s >>= 1)
+				shift_ -= 1;
+			nmem::memclr(root_slot(), siglen_);
+			clear();
+		}
+
+		void sparse_t::clear()
+		{
+			for (u32 i = 0; i <= mask_; ++i)
+				keys_[i] = bin_t::NONE.value();
+			nmem::memclr(zero_slot(), siglen_);
+			present_->clear();
+			present_->set(bin_t(0, root_.value()));
+			count_ = 0;
+		}
+
+		u8* sparse_t::find(bin_t _bin) const
+		{
+			if (!has(_bin))
+				return zero_slot();
+			if (_bin == root_)
+				return root_slot();
+
+			u32 i = slot_of(_bin);
+			while (keys_[i] != _bin.value())
+				i = (i + 1) & mask_;
+			return digests_ + ((u64)i * siglen_);
+		}
+
+		/*
+		 Linear probing, the table never holds more than 3/4 of its slots so a probe always ends
+		 at the bin or at an empty slot. Signatures are never removed, only clear() empties the table.
+		*/
+		u8* sparse_t::insert(bin_t _bin)
+		{
+			if (_bin == root_)
+				return root_slot();
+
+			u32 i = slot_of(_bin);
+			if (has(_bin))
+			{
+				while (keys_[i] != _bin.value())
+					i = (i + 1) & mask_;
+				return digests_ + ((u64)i * siglen_);
+			}
+			if (count_ == max_count_)
+				return nullptr;
+
+			while (keys_[i] != bin_t::NONE.value())
+				i = (i + 1) & mask_;
+			keys_[i] = _bin.value();
+			present_->set(bin_t(0, _bin.value()));
+			count_ += 1;
+			return digests_ + ((u64)i * siglen_);
+		}
+
 		ctree::ctree()
 			: root_bin_(0)
+			, layout_(LAYOUT_INORDER)
+			, sparse_(0)
 			, data_(0)
 		{
 		}
 
 		ctree::ctree(data_t& _data)
 			: root_bin_(0)
+			, layout_(_data.get_layout())
+			, sparse_(_data.get_sparse())
 			, data_(0)
 		{
 			root_bin_ = (bin_t*)_data.get_data();
@@ -136,7 +201,27 @@ namespace ncore
 
 			data_ = _data.get_data() + sizeof(bin_t) + _data.get_siglen();
 			root_sig_ = hash_t(nullptr, _data.get_siglen());
-			read(*root_bin_, root_sig_);
+			if (sparse_ != nullptr)
+			{
+				// the root slot is reserved by the sparse table, it is written by tree
+				ASSERT(sparse_->has(*root_bin_));
+				root_sig_.digest_ = sparse_->find(*root_bin_);
+			}
+			else
+			{
+				read(*root_bin_, root_sig_);
+			}
+		}
+
+		bool ctree::has(bin_t _bin) const
+		{
+			if (!root_bin_->contains(_bin))
+				return false;
+			if (sparse_ != nullptr)
+				return sparse_->has(_bin);
+			hash_t sig;
+			read(_bin, sig);
+			return !is_zero(sig);
 		}
 
 		s32 ctree::read(bin_t _bin, branch_t& _branch) const
@@ -145,22 +230,22 @@ namespace ncore
 			if (!root_bin_->contains(_bin))
 				return -1;	// out of range
 
-			// is there enough space in the destination to write the full branch?
-			if ((_branch.length() - _branch.size()) <= (u32)root_bin_->layer())
+			// is there enough space in the destination to write the full branch (base pair, uncles and root)?
+			if ((_branch.length() - _branch.size()) < (u32)(root_bin_->layer() - _bin.layer() + 2))
 				return -2;
 
-			hash_t sig;
-			read(_bin, sig);
-			if (is_zero(sig))
+			if (!has(_bin))
 				return -3;
 
+			hash_t sig;
+
 			if (_bin != *root_bin_)
 			{
 				bin_t iter = _bin;
 				if (iter.is_right())
 					iter.to_sibling();
 
-				read(iter.sibling(), sig);
+				read(iter, sig);
 				_branch.push(sig);
 				do
 				{
@@ -175,14 +260,248 @@ namespace ncore
 			return _branch.size();
 		}
 
+		namespace
+		{
+			struct range_t
+			{
+				bin_t		first_;
+				bin_t		last_;
+
+				// the bins of the layer of the range that @_bin covers overlap the range
+				inline bool	overlaps(bin_t _bin) const
+				{
+					s32 const shift = _bin.layer() - first_.layer();
+					u64 const lo = _bin.layer_offset() << shift;
+					u64 const hi = lo + ((u64)1 << shift) - 1;
+					return lo <= last_.layer_offset() && hi >= first_.layer_offset();
+				}
+
+				// the signature of @_bin is part of the proof, it is in the range or it is a sibling outside of it
+				inline bool	is_leaf(bin_t _bin) const		{ return _bin.layer() == first_.layer() || !overlaps(_bin); }
+
+				bool		valid(bin_t _root) const
+				{
+					return _root.contains(first_) && _root.contains(last_) && first_.layer() == last_.layer() && first_ <= last_;
+				}
+			};
+
+			/*
+			 Visit the bins of the proof in depth-first, left to right order
+			*/
+			template <typename V>
+			bool		visit_proof(range_t const& _range, bin_t _bin, V& _visitor)
+			{
+				if (_range.is_leaf(_bin))
+					return _visitor(_bin);
+				return visit_proof(_range, _bin.left(), _visitor) && visit_proof(_range, _bin.right(), _visitor);
+			}
+
+			struct proof_reader_t
+			{
+				ctree const*	tree_;
+				branch_t*		proof_;
+				bool operator()(bin_t _bin)
+				{
+					if (!tree_->has(_bin))
+						return false;
+					hash_t sig;
+					tree_->read(_bin, sig);
+					return proof_->push(sig) == 1;
+				}
+			};
+
+			struct proof_counter_t
+			{
+				u32				count_;
+				bool operator()(bin_t)			{ count_ += 1; return true; }
+			};
+
+			/*
+			 Resolve the signature of @_bin from the proof into scratch slot @_slot, deeper slots are
+			 used for the right children, so every internal node is combined exactly once.
+			*/
+			struct proof_resolver_t
+			{
+				range_t			range_;
+				branch_t const*	proof_;
+				combine_f		combine_f_;
+				u32				siglen_;
+				u32				next_;
+				u8*				slots_;
+				u8*				record_;		// optional, every resolved signature in depth-first post-order
+				u32				recorded_;
+
+				hash_t			slot(s32 _slot)		{ return hash_t(slots_ + (u64)_slot * siglen_, siglen_); }
+
+				bool			child(bin_t _bin, s32 _slot, hash_t& _out)
+				{
+					if (range_.is_leaf(_bin))
+					{
+						hash_t const* sig = (*proof_)[next_++];
+						if (sig == nullptr)
+							return false;
+						_out = *sig;
+						return true;
+					}
+					return resolve(_bin, _slot, _out);
+				}
+
+				// without a record a slot per layer is reused, the left child is overwritten by its parent
+				bool			resolve(bin_t _bin, s32 _slot, hash_t& _out)
+				{
+					hash_t lsig, rsig;
+					if (!child(_bin.left(), _slot, lsig))
+						return false;
+					if (!child(_bin.right(), _slot + 1, rsig))
+						return false;
+					_out = record_ != nullptr ? hash_t(record_ + (u64)recorded_++ * siglen_, siglen_) : slot(_slot);
+					combine_f_(lsig, rsig, _out);
+					return true;
+				}
+			};
+		}
+
+		/*
+		 The proof holds the signatures of the bins in the range and of the siblings just outside of it,
+		 in depth-first order. Shared ancestors are never repeated, so a range of k bins costs k signatures
+		 plus at most 2 per layer.
+		*/
+		s32 ctree::read_range(bin_t _first, bin_t _last, branch_t& _proof) const
+		{
+			range_t range;
+			range.first_ = _first;
+			range.last_  = _last;
+			if (!range.valid(*root_bin_))
+				return -1;	// out of range
+
+			proof_counter_t counter;
+			counter.count_ = 0;
+			visit_proof(range, *root_bin_, counter);
+			if ((_proof.length() - _proof.size()) < counter.count_)
+				return -2;
+
+			proof_reader_t reader;
+			reader.tree_  = this;
+			reader.proof_ = &_proof;
+			if (!visit_proof(range, *root_bin_, reader))
+				return -3;
+
+			return _proof.size();
+		}
+
+		/*
+		 The branch of a bin for a receiver that already trusts some of the signatures, the base pair
+		 followed by the uncles until the parent is a bin that the receiver trusts.
+		*/
+		s32 ctree::read(bin_t _bin, branch_t& _branch, binmaps::binmap const& _trusted) const
+		{
+			// do we contain this bin ?
+			if (!root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -1;	// out of range
+
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+
+			u32 count = 2;
+			for (bin_t p = iter.parent(); p != *root_bin_ && !_trusted.is_filled(tree::trusted_bin(p)); p.to_parent())
+				count += 1;
+			if ((_branch.length() - _branch.size()) < count)
+				return -2;
+
+			if (!has(_bin))
+				return -3;
+
+			hash_t sig;
+
+			read(iter, sig);
+			_branch.push(sig);
+			read(iter.sibling(), sig);
+			_branch.push(sig);
+			for (count -= 2; count > 0; --count)
+			{
+				iter.to_parent();
+				read(iter.sibling(), sig);
+				_branch.push(sig);
+			}
+			return _branch.size();
+		}
+
+		/*
+		 A peer that verified a bin stored the signatures of its branch, so it knows the signature of
+		 every bin that has an acknowledged bin under its parent.
+		*/
+		static inline bool is_known(binmaps::binmap const& _acked, bin_t _bin)
+		{
+			return !_acked.is_empty(_bin.parent());
+		}
+
+		/*
+		 The base pair followed by the uncles up to the root, leaving out every signature that the peer
+		 knows. The peer knows which ones were left out from its own acknowledged bins.
+		*/
+		s32 ctree::read_trimmed(bin_t _bin, branch_t& _branch, binmaps::binmap const& _acked) const
+		{
+			// do we contain this bin ?
+			if (!root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -1;	// out of range
+
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+
+			u32 count = 0;
+			if (iter == _bin || !is_known(_acked, iter))
+				count += 1;
+			if (iter.sibling() == _bin || !is_known(_acked, iter.sibling()))
+				count += 1;
+			for (bin_t b = iter.parent(); b != *root_bin_; b.to_parent())
+			{
+				if (!is_known(_acked, b.sibling()))
+					count += 1;
+			}
+			if ((_branch.length() - _branch.size()) < count)
+				return -2;
+
+			if (!has(_bin))
+				return -3;
+
+			hash_t sig;
+
+			if (iter == _bin || !is_known(_acked, iter))
+			{
+				read(iter, sig);
+				_branch.push(sig);
+			}
+			if (iter.sibling() == _bin || !is_known(_acked, iter.sibling()))
+			{
+				read(iter.sibling(), sig);
+				_branch.push(sig);
+			}
+			for (iter.to_parent(); iter != *root_bin_; iter.to_parent())
+			{
+				if (!is_known(_acked, iter.sibling()))
+				{
+					read(iter.sibling(), sig);
+					_branch.push(sig);
+				}
+			}
+			return _branch.size();
+		}
+
 		tree::tree()
 			: ctree()
+			, combine_f_(0)
+			, combine_batch_f_(0)
+			, trusted_(0)
 		{
 		}
 
-		tree::tree(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner)
+		tree::tree(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, combine_batch_f _batchcombiner)
 			: ctree(_data)
 			, combine_f_(_sigcombiner)
+			, combine_batch_f_(_batchcombiner)
+			, trusted_(0)
 		{
 			copy(root_sig_, _rootsig);
 		}
@@ -197,161 +516,1149 @@ namespace ncore
 		//
 		s32 tree::write(bin_t _bin, branch_t const& _branch)
 		{
-			// do we contain this bin ?
-			if (!root_bin_->contains(_bin))
-				return -2;	// out of range
+			ASSERT(root_sig_.length_ <= c_max_siglen);
+			u8 ancestors[64 * c_max_siglen];
 
-			// First step: Determine if this branch resolves to the root signature
-			s32 i = 0;
-			hash_t const* lhs = _branch[i++];
-			hash_t const* rhs = _branch[i++];
+			verify_t item;
+			item.bin_       = _bin;
+			item.branch_    = &_branch;
+			item.result_    = 0;
+			item.ancestors_ = trusted_ != nullptr ? ancestors : nullptr;
+			verify(&item, 1);
+			if (item.result_ != -1)
+				return item.result_;
+			if (!has_room(2 * (u32)(root_bin_->layer() - _bin.layer() + 1)))
+				return -4;	// full
 
-			bin_t iter = _bin;
-			while (true)
+			store(_bin, _branch, item.ancestors_);
+			return -1;
+		}
+
+		void tree::set_trusted(binmaps::binmap* _trusted)
+		{
+			trusted_ = _trusted;
+			if (trusted_ != nullptr)
 			{
-				combine_f_(*lhs, *rhs, work_sig_);
-				iter.to_parent();
-				if (iter == *root_bin_)
-				{
-					break;
-				}
-				else if (iter.is_left())
-				{
-					lhs = &work_sig_;
-					rhs = _branch[i++];
-				}
-				else //if (_bin.is_right())
+				ASSERT(trusted_->root().contains(trusted_bin(*root_bin_)));
+				trusted_->set(trusted_bin(*root_bin_));
+			}
+		}
+
+		namespace
+		{
+			struct lane_t
+			{
+				bin_t			iter_;
+				u32				next_;
+				verify_t*		item_;
+			};
+		}
+
+		/*
+		 Verify branches without writing to the tree, so any number of threads can call this at the same time
+		 as long as nobody writes to the tree. A branch is combined up to the root, or with a trusted binmap up
+		 to the first trusted ancestor (the branch can stop there). The branches are verified in lanes of up to
+		 c_combine_batch_size, all lanes advance one layer per step so a multi-lane combiner can hash them at once.
+		*/
+		void tree::verify(verify_t* _items, u32 _count) const
+		{
+			u32 const siglen = root_sig_.length_;
+			ASSERT(siglen <= c_max_siglen);
+
+			u8     scratch[c_combine_batch_size * c_max_siglen];
+			lane_t lanes[c_combine_batch_size];
+			hash_t lsigs[c_combine_batch_size];
+			hash_t rsigs[c_combine_batch_size];
+			hash_t works[c_combine_batch_size];
+
+			for (u32 begin = 0; begin < _count; begin += c_combine_batch_size)
+			{
+				u32 const end = (begin + c_combine_batch_size) < _count ? (begin + c_combine_batch_size) : _count;
+
+				// first step: the base pairs
+				u32 n = 0;
+				for (u32 i = begin; i < end; ++i)
 				{
-					lhs = _branch[i++];
-					rhs = &work_sig_;
+					verify_t& item = _items[i];
+					branch_t const& branch = *item.branch_;
+					if (!root_bin_->contains(item.bin_) || item.bin_ == *root_bin_ || branch.size() < 2 || (trusted_ != nullptr && item.ancestors_ == nullptr))
+					{
+						item.result_ = -2;	// out of range or malformed, or no room for the ancestors
+						continue;
+					}
+					lane_t& lane = lanes[n];
+					lane.iter_ = item.bin_.parent();
+					lane.next_ = 2;
+					lane.item_ = &item;
+					works[n] = hash_t(item.ancestors_ != nullptr ? item.ancestors_ : scratch + (n * siglen), siglen);
+					lsigs[n] = *branch[0];
+					rsigs[n] = *branch[1];
+					n += 1;
 				}
-			}
 
-			if (are_nequal(root_sig_, work_sig_))
-				return -3;
+				while (n > 0)
+				{
+					if (combine_batch_f_ != nullptr && n > 1)
+						combine_batch_f_(lsigs, rsigs, works, n);
+					else
+						for (u32 k = 0; k < n; ++k)
+							combine_f_(lsigs[k], rsigs[k], works[k]);
 
-			// The branch is valid, proceed
+					// next step: finish the lanes that reached a trusted bin, the others combine with their uncle
+					u32 active = 0;
+					for (u32 k = 0; k < n; ++k)
+					{
+						lane_t lane = lanes[k];
+						hash_t const work = works[k];
+						if (lane.iter_ == *root_bin_ || is_trusted(lane.iter_))
+						{
+							hash_t trusted;
+							read(lane.iter_, trusted);
+							lane.item_->result_ = are_equal(trusted, work) ? -1 : -3;
+							continue;
+						}
 
-			iter = _bin;
+						hash_t const* uncle = (*lane.item_->branch_)[lane.next_++];
+						if (uncle == nullptr)
+						{
+							lane.item_->result_ = -2;	// the branch ends before a trusted ancestor
+							continue;
+						}
 
-			i = 0;
+						lsigs[active] = lane.iter_.is_left() ? work : *uncle;
+						rsigs[active] = lane.iter_.is_left() ? *uncle : work;
+						works[active] = lane.item_->ancestors_ != nullptr ? hash_t(lane.item_->ancestors_ + (u64)(lane.next_ - 2) * siglen, siglen) : work;
+						lane.iter_.to_parent();
+						lanes[active] = lane;
+						active += 1;
+					}
+					n = active;
+				}
+			}
+		}
 
-			hash_t base_sig;
-			read(iter, base_sig);
-			hash_t base_sibling_sig;
-			read(iter.sibling(), base_sibling_sig);
+		/*
+		 Store a verified branch, the base pair and the uncles. With a trusted binmap the ancestors that
+		 verify() combined are stored too and everything up to the first trusted ancestor becomes trusted.
+		*/
+		void tree::store(bin_t _bin, branch_t const& _branch, u8 const* _ancestors)
+		{
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
 
 			// Increase the signature submit count whenever we are adding a signature in layer 0
-			if (is_zero(base_sig))
+			if (!has(iter))
 				added_count_sig_++;
-
-			if (is_zero(base_sibling_sig))
+			if (!has(iter.sibling()))
 				added_count_sig_++;
 
-			if (iter.is_left())
-			{
-				write(iter, *_branch[i++]);
-				write(iter.sibling(), *_branch[i++]);
-			}
-			else
+			write(iter, *_branch[0]);
+			write(iter.sibling(), *_branch[1]);
+
+			s32 i = 2;
+			if (trusted_ == nullptr)
 			{
-				write(iter.sibling(), *_branch[i++]);
-				write(iter, *_branch[i++]);
+				while (true)
+				{
+					iter.to_parent();
+					if (iter == *root_bin_)
+						break;
+					write(iter.sibling(), *_branch[i++]);
+				}
+				return;
 			}
 
-			while (true)
+			ASSERT(_ancestors != nullptr);
+			u32 const siglen = root_sig_.length_;
+			trusted_->set(trusted_bin(iter));
+			trusted_->set(trusted_bin(iter.sibling()));
+			iter.to_parent();
+			for (u32 a = 0; !is_trusted(iter); ++a)
 			{
-				iter.to_parent();
-				if (iter == *root_bin_)
-					break;
+				write(iter, hash_t((u8*)_ancestors + (u64)a * siglen, siglen));
 				write(iter.sibling(), *_branch[i++]);
+				trusted_->set(trusted_bin(iter));
+				trusted_->set(trusted_bin(iter.sibling()));
+				iter.to_parent();
 			}
-
-			return -1;
 		}
 
-
-		tree::builder::builder(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner)
-			: combine_f_(_sigcombiner)
-			, root_bin_(0)
-			, data_(0)
+		namespace
 		{
-			root_bin_ = (bin_t*)_data.get_data();
-			*root_bin_ = _data.get_root();
-
-			work_sig_ = hash_t(nullptr, _data.get_siglen());
-			work_sig_.digest_ = _data.get_data() + sizeof(bin_t);
-
-			data_ = _data.get_data() + sizeof(bin_t) + _data.get_siglen();
-			root_sig_ = hash_t(nullptr, _data.get_siglen());
-			read(*root_bin_, root_sig_);
-
-			u32 const data_size = data_t::size_for(*root_bin_, _data.get_siglen()) - sizeof(bin_t);
-			nmem::memclr(_data.get_data() + sizeof(bin_t), data_size);
+			struct verify_job_t
+			{
+				tree const*		tree_;
+				verify_t*		items_;
+				u32				count_;
+				u32				per_job_;
+			};
 		}
 
-		s32				tree::builder::write(bin_t _bin, hash_t const& _sig)
+		void tree::verify_job(void* _ctx, u32 _index)
 		{
-			// do we contain this bin ?
-			if (!root_bin_->contains(_bin))
-				return -2;	// out of range
-
-			hash_t s;
-			read(_bin, s);
-			copy(s, _sig);
-
-			return 1;
+			verify_job_t const* job = (verify_job_t const*)_ctx;
+			u32 const begin = _index * job->per_job_;
+			u32 const end = (begin + job->per_job_) < job->count_ ? (begin + job->per_job_) : job->count_;
+			job->tree_->verify(job->items_ + begin, end - begin);
 		}
 
 		/*
-		 Build the signature tree from the base level up until the root
+		 Verify many branches in parallel, each job uses its own scratch signatures on the stack and only
+		 reads the tree. The accepted branches are then stored by the calling thread, in order.
+		 With a trusted binmap every item needs its ancestors_ (-2 without).
 		*/
-		bool			tree::builder::build()
+		u32 tree::write_batch(verify_t* _items, u32 _count, parallel_for_f _parallel_for, void* _user)
 		{
-			bool is_complete = true;
-			u32 w = (u32)root_bin_->base_length();
-			for (u32 o=0; is_complete && o<w; ++o)
-			{
-				hash_t sig;
-				read(bin_t(0, o), sig);
-				is_complete = is_complete || !is_zero(sig);
-			}
+			if (_count == 0)
+				return 0;
 
-			if (!is_complete)
-				return false;
+			verify_job_t job;
+			job.tree_    = this;
+			job.items_   = _items;
+			job.count_   = _count;
+			job.per_job_ = c_combine_batch_size * 4;
+			u32 const jobs = (_count + job.per_job_ - 1) / job.per_job_;
+			if (_parallel_for != nullptr && jobs > 1)
+				_parallel_for(verify_job, &job, jobs, _user);
+			else
+				verify(_items, _count);
 
-			bin_t ib(root_bin_->base_right());
-			u32 layer = 0;
-			while (ib != *root_bin_)
+			u32 accepted = 0;
+			for (u32 i = 0; i < _count; ++i)
 			{
-				++layer;
-				ib.to_parent();
-
-				w = (u32)ib.layer_offset() + 1;
-				for (u32 o=0; o<w; ++o)
+				if (_items[i].result_ == -1 && !has_room(2 * (u32)(root_bin_->layer() - _items[i].bin_.layer() + 1)))
+					_items[i].result_ = -4;	// full
+				if (_items[i].result_ == -1)
 				{
-					hash_t psig;
-					read(bin_t(layer, o), psig);
-					hash_t lsig, rsig;
-					read(bin_t(layer-1, (2*o)+0), lsig);
-					read(bin_t(layer-1, (2*o)+1), rsig);
-					combine_f_(lsig, rsig, psig);
+					store(_items[i].bin_, *_items[i].branch_, _items[i].ancestors_);
+					accepted += 1;
 				}
 			}
-
-			return true;
+			return accepted;
 		}
 
 		/*
-		 Build the signature tree from the base level up until the root and then
-		 validate the root against the given root signature
+		 Complete a trimmed branch with the signatures that this tree knows and verify it.
+		 The acknowledged bins have to be written with a trusted binmap, which also stores the
+		 ancestors of the branch (see set_trusted), otherwise not all left out signatures are known.
 		*/
-		bool			tree::builder::build_and_verify(hash_t const& _root_signature)
+		s32 tree::write_trimmed(bin_t _bin, branch_t const& _branch, binmaps::binmap const& _acked)
 		{
-			if (!build())
-				return false;
+			// do we contain this bin ?
+			if (!root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -2;	// out of range
+
+			ASSERT(root_sig_.length_ <= c_max_siglen);
+			u8 digests[(64 + 1) * c_max_siglen];
+			hash_t hashes[64 + 1];
+			u32 const capacity = (u32)(root_bin_->layer() - _bin.layer()) + 1;
+			for (u32 i=0; i<capacity; ++i)
+				hashes[i] = hash_t(digests + (i * root_sig_.length_), root_sig_.length_);
+			branch_t full(hashes, capacity);
+
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+
+			s32 next = 0;
+			for (s32 k=0; k<2; ++k)
+			{
+				bin_t const b = (k == 0) ? iter : iter.sibling();
+				hash_t const* sig = _branch[next];
+				hash_t stored;
+				if (b != _bin && is_known(_acked, b))
+				{
+					if (!has(b))
+						return -2;	// acknowledged but unknown
+					read(b, stored);
+					sig = &stored;
+				}
+				else
+				{
+					next += 1;
+				}
+				if (sig == nullptr)
+					return -2;
+				full.push(*sig);
+			}
+			for (iter.to_parent(); iter != *root_bin_; iter.to_parent())
+			{
+				hash_t const* sig = _branch[next];
+				hash_t stored;
+				if (is_known(_acked, iter.sibling()))
+				{
+					if (!has(iter.sibling()))
+						return -2;	// acknowledged but unknown
+					read(iter.sibling(), stored);
+					sig = &stored;
+				}
+				else
+				{
+					next += 1;
+				}
+				if (sig == nullptr)
+					return -2;
+				full.push(*sig);
+			}
+
+			return write(_bin, full);
+		}
+
+		/*
+		 Verify a multi-proof against the root signature and when valid store the signatures of the
+		 range and of the siblings. With a trusted binmap the ancestors are stored too and everything
+		 becomes trusted, like store() does for a single branch. The ancestors are the signatures that
+		 were resolved, they are recorded in @_scratch so that no signature is combined twice.
+		*/
+		s32 tree::write_range(bin_t _first, bin_t _last, branch_t const& _proof, u8* _scratch)
+		{
+			range_t range;
+			range.first_ = _first;
+			range.last_  = _last;
+			if (!range.valid(*root_bin_) || root_sig_.length_ > c_max_siglen)
+				return -2;	// out of range
+
+			proof_counter_t counter;
+			counter.count_ = 0;
+			visit_proof(range, *root_bin_, counter);
+			if (_proof.size() != counter.count_)
+				return -2;	// malformed
+
+			if (range.is_leaf(*root_bin_))
+			{
+				if (are_nequal(root_sig_, *_proof[0]))
+					return -3;
+				return -1;
+			}
+
+			// one scratch slot per layer
+			u8 slots[(64 + 1) * c_max_siglen];
+			proof_resolver_t resolver;
+			resolver.range_     = range;
+			resolver.proof_     = &_proof;
+			resolver.combine_f_ = combine_f_;
+			resolver.siglen_    = root_sig_.length_;
+			resolver.next_      = 0;
+			resolver.slots_     = slots;
+			resolver.record_    = trusted_ != nullptr ? _scratch : nullptr;
+			resolver.recorded_  = 0;
+			if (trusted_ != nullptr && _scratch == nullptr)
+				return -2;
+
+			hash_t sig;
+			if (!resolver.resolve(*root_bin_, 0, sig))
+				return -2;
+			if (are_nequal(root_sig_, sig))
+				return -3;
+			if (!has_room(trusted_ != nullptr ? 2 * counter.count_ : counter.count_))
+				return -4;	// full
+
+			// The proof is valid, proceed
+			struct writer_t
+			{
+				tree*			tree_;
+				range_t			range_;
+				branch_t const*	proof_;
+				s32				next_;
+				u8 const*		record_;		// the resolved signatures, visited in the same order
+				u32				recorded_;
+				void store(bin_t _bin)
+				{
+					if (range_.is_leaf(_bin))
+					{
+						tree_->write(_bin, *(*proof_)[next_++]);
+					}
+					else
+					{
+						store(_bin.left());
+						store(_bin.right());
+						if (tree_->trusted_ == nullptr)
+							return;
+						u32 const siglen = tree_->root_sig_.length_;
+						tree_->write(_bin, hash_t((u8*)record_ + (u64)recorded_++ * siglen, siglen));
+					}
+					if (tree_->trusted_ != nullptr)
+						tree_->trusted_->set(trusted_bin(_bin));
+				}
+			} writer;
+			writer.tree_     = this;
+			writer.range_    = range;
+			writer.proof_    = &_proof;
+			writer.next_     = 0;
+			writer.record_   = _scratch;
+			writer.recorded_ = 0;
+			writer.store(root_bin_->left());
+			writer.store(root_bin_->right());
+
+			return -1;
+		}
+
+		tree::builder::builder(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, combine_batch_f _batchcombiner)
+			: combine_f_(_sigcombiner)
+			, combine_batch_f_(_batchcombiner)
+			, dirty_(0)
+			, dirty_capacity_(0)
+			, dirty_count_(0)
+			, root_bin_(0)
+			, layout_(_data.get_layout())
+			, data_(0)
+		{
+			ASSERT(_data.get_sparse() == nullptr);	// the builder computes every signature, it needs the dense data
+			root_bin_ = (bin_t*)_data.get_data();
+			*root_bin_ = _data.get_root();
+
+			work_sig_ = hash_t(nullptr, _data.get_siglen());
+			work_sig_.digest_ = _data.get_data() + sizeof(bin_t);
+
+			data_ = _data.get_data() + sizeof(bin_t) + _data.get_siglen();
+			root_sig_ = hash_t(nullptr, _data.get_siglen());
+			read(*root_bin_, root_sig_);
+
+			u64 const data_size = data_t::size_for(*root_bin_, _data.get_siglen()) - sizeof(bin_t);
+			nmem::memclr(_data.get_data() + sizeof(bin_t), data_size);
+		}
+
+		s32				tree::builder::write(bin_t _bin, hash_t const& _sig)
+		{
+			// do we contain this bin ?
+			if (!root_bin_->contains(_bin))
+				return -2;	// out of range
+
+			hash_t s;
+			read(_bin, s);
+			copy(s, _sig);
+
+			return 1;
+		}
+
+		bool			tree::builder::is_complete() const
+		{
+			// every leaf needs a signature, a zero signature is a leaf that was never written
+			bool is_complete = true;
+			u64 const first = root_bin_->base_offset();
+			u64 const w = root_bin_->base_length();
+			for (u64 o=0; is_complete && o<w; ++o)
+			{
+				hash_t sig;
+				read(bin_t(0, first + o), sig);
+				is_complete = !is_zero(sig);
+			}
+			return is_complete;
+		}
+
+		/*
+		 Combine the signatures of (@_layer - 1) into @_count signatures of @_layer starting at @_offset
+		*/
+		void			tree::builder::build_layer(s32 _layer, u64 _offset, u64 _count)
+		{
+			// in both layouts the index of a node is linear in its layer offset, so walk the
+			// parents and the left/right children with a fixed stride instead of per bin lookups
+			u64 const siglen = root_sig_.length_;
+			u64 const p  = data_t::index_of(*root_bin_, layout_, bin_t(_layer, _offset));
+			u64 const ps = data_t::index_of(*root_bin_, layout_, bin_t(_layer, _offset + 1)) - p;
+			u64 const l  = data_t::index_of(*root_bin_, layout_, bin_t(_layer - 1, 2 * _offset));
+			u64 const r  = data_t::index_of(*root_bin_, layout_, bin_t(_layer - 1, (2 * _offset) + 1));
+			u64 const cs = data_t::index_of(*root_bin_, layout_, bin_t(_layer - 1, (2 * _offset) + 2)) - l;
+
+			u8* psig_ptr = data_ + (p * siglen);
+			u8* lsig_ptr = data_ + (l * siglen);
+			u8* rsig_ptr = data_ + (r * siglen);
+
+			if (combine_batch_f_ != nullptr)
+			{
+				// feed the multi-lane combiner full batches, only the last one can be partial
+				hash_t lsigs[c_combine_batch_size];
+				hash_t rsigs[c_combine_batch_size];
+				hash_t psigs[c_combine_batch_size];
+				u64 o = 0;
+				while (o < _count)
+				{
+					u32 n = 0;
+					for (; n<c_combine_batch_size && o<_count; ++n, ++o)
+					{
+						psigs[n] = hash_t(psig_ptr, (u32)siglen);
+						lsigs[n] = hash_t(lsig_ptr, (u32)siglen);
+						rsigs[n] = hash_t(rsig_ptr, (u32)siglen);
+						psig_ptr += ps * siglen;
+						lsig_ptr += cs * siglen;
+						rsig_ptr += cs * siglen;
+					}
+					combine_batch_f_(lsigs, rsigs, psigs, n);
+				}
+				return;
+			}
+
+			for (u64 o=0; o<_count; ++o)
+			{
+				hash_t psig(psig_ptr, (u32)siglen);
+				hash_t lsig(lsig_ptr, (u32)siglen);
+				hash_t rsig(rsig_ptr, (u32)siglen);
+				combine_f_(lsig, rsig, psig);
+				psig_ptr += ps * siglen;
+				lsig_ptr += cs * siglen;
+				rsig_ptr += cs * siglen;
+			}
+		}
+
+		/*
+		 Combine the signatures of (@_layer - 1) into the signatures of @_layer at the @_count given offsets
+		*/
+		void			tree::builder::rehash(s32 _layer, u64 const* _offsets, u32 _count)
+		{
+			if (combine_batch_f_ != nullptr)
+			{
+				hash_t lsigs[c_combine_batch_size];
+				hash_t rsigs[c_combine_batch_size];
+				hash_t psigs[c_combine_batch_size];
+				u32 i = 0;
+				while (i < _count)
+				{
+					u32 n = 0;
+					for (; n<c_combine_batch_size && i<_count; ++n, ++i)
+					{
+						u64 const o = _offsets[i];
+						read(bin_t(_layer, o), psigs[n]);
+						read(bin_t(_layer-1, (2*o)+0), lsigs[n]);
+						read(bin_t(_layer-1, (2*o)+1), rsigs[n]);
+					}
+					combine_batch_f_(lsigs, rsigs, psigs, n);
+				}
+				return;
+			}
+
+			for (u32 i=0; i<_count; ++i)
+			{
+				u64 const o = _offsets[i];
+				hash_t psig;
+				read(bin_t(_layer, o), psig);
+				hash_t lsig, rsig;
+				read(bin_t(_layer-1, (2*o)+0), lsig);
+				read(bin_t(_layer-1, (2*o)+1), rsig);
+				combine_f_(lsig, rsig, psig);
+			}
+		}
+
+		/*
+		 Build the signatures of the sub-tree of @_bin from the base level up until @_bin
+		*/
+		void			tree::builder::build_subtree(bin_t _bin)
+		{
+			s32 const top = _bin.layer();
+			for (s32 layer=1; layer<=top; ++layer)
+			{
+				u64 const count = (u64)1 << (top - layer);
+				build_layer(layer, _bin.layer_offset() * count, count);
+			}
+		}
+
+		s32				tree::builder::build(bin_t _subtree)
+		{
+			if (!root_bin_->contains(_subtree))
+				return -2;	// out of range
+			build_subtree(_subtree);
+			return 0;
+		}
+
+		void			tree::builder::build_above(s32 _layer)
+		{
+			s32 const top = root_bin_->layer();
+			for (s32 layer=_layer+1; layer<=top; ++layer)
+			{
+				u64 const count = (u64)1 << (top - layer);
+				build_layer(layer, root_bin_->layer_offset() * count, count);
+			}
+		}
+
+		/*
+		 Build the signature tree from the base level up until the root
+		*/
+		bool			tree::builder::build()
+		{
+			if (!is_complete())
+				return false;
+
+			build_subtree(*root_bin_);
+			return true;
+		}
+
+		namespace
+		{
+			struct build_job_t
+			{
+				tree::builder*	builder_;
+				s32				layer_;
+				u64				first_;		// layer offset of the first sub-tree
+			};
+		}
+
+		void			tree::builder::build_subtree_job(void* _ctx, u32 _index)
+		{
+			build_job_t const* job = (build_job_t const*)_ctx;
+			job->builder_->build_subtree(bin_t(job->layer_, job->first_ + _index));
+		}
+
+		/*
+		 Build the signature tree in parallel, the tree is split into independent sub-trees
+		 that are handed to the parallel-for, the top layers are then built serially.
+		 The result is identical to build().
+		*/
+		bool			tree::builder::build(parallel_for_f _parallel_for, void* _user)
+		{
+			if (!is_complete())
+				return false;
+
+			// at most 256 sub-trees, but do not bother splitting up small trees
+			s32 const root_layer = root_bin_->layer();
+			s32 split_layer = root_layer - 8;
+			if (split_layer < 10)
+				split_layer = root_layer < 10 ? root_layer : 10;
+
+			build_job_t job;
+			job.builder_ = this;
+			job.layer_   = split_layer;
+			job.first_   = root_bin_->base_offset() >> split_layer;
+			u32 const count = (u32)(root_bin_->base_length() >> split_layer);
+			if (_parallel_for != nullptr && count > 1)
+				_parallel_for(build_subtree_job, &job, count, _user);
+			else
+				for (u32 i = 0; i < count; ++i)
+					build_subtree_job(&job, i);
+
+			build_above(split_layer);
+
+			return true;
+		}
+
+		static void		sift_down(u64* _a, u32 _root, u32 _count)
+		{
+			u64 const v = _a[_root];
+			u32 i = _root;
+			while (true)
+			{
+				u32 c = (2 * i) + 1;
+				if (c >= _count)
+					break;
+				if ((c + 1) < _count && _a[c + 1] > _a[c])
+					c += 1;
+				if (_a[c] <= v)
+					break;
+				_a[i] = _a[c];
+				i = c;
+			}
+			_a[i] = v;
+		}
+
+		// in-place heap sort, no allocation and O(k log k) for any input
+		static void		sort(u64* _a, u32 _count)
+		{
+			if (_count < 2)
+				return;
+			for (u32 i = _count / 2; i > 0; --i)
+				sift_down(_a, i - 1, _count);
+			for (u32 n = _count - 1; n > 0; --n)
+			{
+				u64 const t = _a[0];
+				_a[0] = _a[n];
+				_a[n] = t;
+				sift_down(_a, 0, n);
+			}
+		}
+
+		void			tree::builder::set_dirty_queue(u64* _queue, u32 _capacity)
+		{
+			if (dirty_count_ > 0)
+				commit();
+			dirty_ = _queue;
+			dirty_capacity_ = _capacity;
+			dirty_count_ = 0;
+		}
+
+		/*
+		 Write the signature of a leaf of an already built tree and queue it for commit(),
+		 without a queue the path to the root is rehashed immediately.
+		*/
+		s32				tree::builder::update_leaf(bin_t _bin, hash_t const& _sig)
+		{
+			if (!root_bin_->contains(_bin) || !_bin.is_base())
+				return -2;	// out of range
+
+			hash_t s;
+			read(_bin, s);
+			copy(s, _sig);
+
+			if (dirty_capacity_ == 0)
+			{
+				u64 o = _bin.layer_offset();
+				for (s32 layer=1; layer<=root_bin_->layer(); ++layer)
+				{
+					o >>= 1;
+					rehash(layer, &o, 1);
+				}
+				return 1;
+			}
+
+			s32 result = 1;
+			if (dirty_count_ == dirty_capacity_)
+			{
+				commit();
+				result = 0;
+			}
+			dirty_[dirty_count_++] = _bin.layer_offset();
+			return result;
+		}
+
+		/*
+		 Rehash the ancestors of the queued leaves layer by layer, the sorted offsets of a layer
+		 map to sorted parent offsets so shared ancestors are adjacent and are removed in place.
+		*/
+		u32				tree::builder::commit()
+		{
+			u32 count = dirty_count_;
+			dirty_count_ = 0;
+			if (count == 0)
+				return 0;
+
+			sort(dirty_, count);
+
+			u32 rehashed = 0;
+			for (s32 layer=1; layer<=root_bin_->layer(); ++layer)
+			{
+				u32 n = 0;
+				for (u32 i=0; i<count; ++i)
+				{
+					u64 const parent = dirty_[i] >> 1;
+					if (n == 0 || dirty_[n - 1] != parent)
+						dirty_[n++] = parent;
+				}
+				count = n;
+				rehash(layer, dirty_, count);
+				rehashed += count;
+			}
+			return rehashed;
+		}
+
+		/*
+		 Build the signature tree from the base level up until the root and then
+		 validate the root against the given root signature
+		*/
+		bool			tree::builder::build_and_verify(hash_t const& _root_signature)
+		{
+			if (!build())
+				return false;
 
 			return are_equal(_root_signature, root_sig_);
 		}
+
+		namespace
+		{
+			/*
+			 The differing leaves arrive left to right, a run of consecutive leaves is reported as the
+			 maximal bins that cover it exactly.
+			*/
+			struct diff_reporter_t
+			{
+				diff_f			on_diff_;
+				void*			user_;
+				u64				first_;
+				u64				end_;
+
+				void			leaf(u64 _offset)
+				{
+					if (_offset == end_ && end_ != first_)
+					{
+						end_ += 1;
+						return;
+					}
+					flush();
+					first_ = _offset;
+					end_   = _offset + 1;
+				}
+
+				void			flush()
+				{
+					u64 lo = first_;
+					while (lo < end_)
+					{
+						s32 layer = 0;
+						while ((lo & (((u64)2 << layer) - 1)) == 0 && (lo + ((u64)2 << layer)) <= end_)
+							layer += 1;
+						on_diff_(bin_t(layer, lo >> layer), user_);
+						lo += (u64)1 << layer;
+					}
+					first_ = end_;
+				}
+			};
+
+			struct diff_local_t
+			{
+				ctree const*		a_;
+				ctree const*		b_;
+				diff_reporter_t*	reporter_;
+				s64					compared_;
+
+				bool			differs(bin_t _bin)
+				{
+					compared_ += 1;
+					hash_t sa, sb;
+					a_->read(_bin, sa);
+					b_->read(_bin, sb);
+					return are_nequal(sa, sb);
+				}
+
+				// @_bin differs, descend into the children that differ
+				void			descend(bin_t _bin)
+				{
+					if (_bin.is_base())
+					{
+						reporter_->leaf(_bin.layer_offset());
+						return;
+					}
+					if (differs(_bin.left()))
+						descend(_bin.left());
+					if (differs(_bin.right()))
+						descend(_bin.right());
+				}
+			};
+		}
+
+		s64		diff(ctree const& _a, ctree const& _b, diff_f _on_diff, void* _user)
+		{
+			if (_a.get_root() != _b.get_root() || _a.get_siglen() != _b.get_siglen())
+				return -1;
+
+			diff_reporter_t reporter;
+			reporter.on_diff_ = _on_diff;
+			reporter.user_    = _user;
+			reporter.first_   = 0;
+			reporter.end_     = 0;
+
+			diff_local_t local;
+			local.a_        = &_a;
+			local.b_        = &_b;
+			local.reporter_ = &reporter;
+			local.compared_ = 0;
+			if (local.differs(_a.get_root()))
+				local.descend(_a.get_root());
+			reporter.flush();
+			return local.compared_;
+		}
+
+		/*
+		 Breadth first, the bins of a layer that differ are kept in @_bins in order. Their children are
+		 expanded in place (back to front), fetched from the remote in one call and compared, after which
+		 only the children that differ are kept.
+		*/
+		s64		diff(ctree const& _local, fetch_f _fetch, void* _fetch_user, diff_f _on_diff, void* _user,
+					 bin_t* _bins, u8* _signatures, u32 _capacity)
+		{
+			u32 const siglen = _local.get_siglen();
+			if (_capacity < 1)
+				return -2;
+
+			s64 compared = 0;
+			u32 count = 1;
+			_bins[0] = _local.get_root();
+			while (true)
+			{
+				if (_fetch(_bins, count, _signatures, _fetch_user) != 0)
+					return -1;
+
+				u32 differ = 0;
+				for (u32 i = 0; i < count; ++i)
+				{
+					hash_t sig;
+					_local.read(_bins[i], sig);
+					compared += 1;
+					if (are_nequal(sig, hash_t(_signatures + ((u64)i * siglen), siglen)))
+						_bins[differ++] = _bins[i];
+				}
+				count = differ;
+				if (count == 0 || _bins[0].is_base())
+					break;
+
+				if ((count * 2) > _capacity)
+					return -2;
+				for (u32 i = count; i > 0; --i)
+				{
+					bin_t const b = _bins[i - 1];
+					_bins[(i * 2) - 2] = b.left();
+					_bins[(i * 2) - 1] = b.right();
+				}
+				count *= 2;
+			}
+
+			diff_reporter_t reporter;
+			reporter.on_diff_ = _on_diff;
+			reporter.user_    = _user;
+			reporter.first_   = 0;
+			reporter.end_     = 0;
+			for (u32 i = 0; i < count; ++i)
+				reporter.leaf(_bins[i].layer_offset());
+			reporter.flush();
+			return compared;
+		}
+
+		streamer::streamer(u32 _siglen, u8* _data, combine_f _sigcombiner)
+			: combine_f_(_sigcombiner)
+			, siglen_(_siglen)
+			, count_(0)
+			, length_(0)
+			, data_(_data)
+		{
+			ASSERT(_siglen <= c_max_siglen);
+		}
+
+		void			streamer::reset()
+		{
+			count_ = 0;
+			length_ = 0;
+		}
+
+		/*
+		 The peaks are a stack ordered by decreasing layer, the layers are the set bits of the length.
+		 Appending a leaf merges the peaks of equal layer, just like incrementing the length carries.
+		*/
+		void			streamer::append(hash_t const& _leaf)
+		{
+			ASSERT(count_ < c_max_peaks);
+			hash_t top = at(count_++);
+			copy(top, _leaf);
+
+			for (u64 carry = length_; (carry & 1) != 0; carry >>= 1)
+			{
+				hash_t left = at(count_ - 2);
+				combine_f_(left, at(count_ - 1), left);
+				count_ -= 1;
+			}
+			length_ += 1;
+		}
+
+		s32				streamer::peaks(bin_t* _out_bins, hash_t* _out_signatures) const
+		{
+			gen_peaks(length_, _out_bins);
+			for (s32 i=0; i<count_; ++i)
+				_out_signatures[i] = at(i);
+			return count_;
+		}
+
+		/*
+		 Fold the peaks from right to left, a peak that is lower than its left neighbour is first
+		 combined with the signatures of empty (zero leaf) sub-trees until it reaches the same layer.
+		 @_empty is scratch for the signature of an empty sub-tree.
+		*/
+		static void		fold_peaks(hash_t const* _peaks, s32 _count, u64 _length, hash_t& _empty, hash_t& _out_signature, combine_f _combine)
+		{
+			if (_count == 1)
+			{
+				copy(_out_signature, _peaks[0]);
+				return;
+			}
+
+			nmem::memclr(_empty.digest_, _empty.length_);
+
+			// lift the empty signature to the layer of the lowest peak, which is a left child
+			s32 const root_layer = bin_t::to_root(_length).layer();
+			s32 i = _count - 1;
+			s32 layer = 0;
+			u64 bits = _length;
+			while ((bits & 1) == 0)
+			{
+				_combine(_empty, _empty, _empty);
+				bits >>= 1;
+				layer += 1;
+			}
+			copy(_out_signature, _peaks[i]);
+			_combine(_out_signature, _empty, _out_signature);
+
+			// a peak at the layer of the signature is its left sibling, otherwise the right sibling is empty
+			while (++layer < root_layer)
+			{
+				_combine(_empty, _empty, _empty);
+				bits >>= 1;
+				if ((bits & 1) != 0)
+				{
+					--i;
+					_combine(_peaks[i], _out_signature, _out_signature);
+				}
+				else
+				{
+					_combine(_out_signature, _empty, _out_signature);
+				}
+			}
+		}
+
+		bool			streamer::root(bin_t& _out_root, hash_t& _out_signature) const
+		{
+			if (length_ == 0)
+				return false;
+
+			hash_t peaks[c_max_peaks];
+			for (s32 i = 0; i < count_; ++i)
+				peaks[i] = at(i);
+
+			// the empty sub-tree signature lives on the stack, root() is const and may run concurrently
+			u8     empty_sig[c_max_siglen];
+			hash_t empty(empty_sig, siglen_);
+
+			_out_root = bin_t::to_root(length_);
+			fold_peaks(peaks, count_, length_, empty, _out_signature, combine_f_);
+			return true;
+		}
+
+		// data: [signatures by bin value]
+		append_tree::append_tree(u32 _siglen, u8* _data, u64 _capacity, combine_f _sigcombiner)
+			: combine_f_(_sigcombiner)
+			, siglen_(_siglen)
+			, length_(0)
+			, capacity_(_capacity)
+			, data_(_data)
+		{
+			ASSERT(_siglen <= c_max_siglen && (_siglen & 3) == 0);
+		}
+
+		void			append_tree::reset()
+		{
+			length_ = 0;
+		}
+
+		void			append_tree::grow(u8* _data, u64 _capacity)
+		{
+			ASSERT(_capacity >= length_);
+			data_ = _data;
+			capacity_ = _capacity;
+		}
+
+		/*
+		 A leaf that is a right child completes its parent, and so on up while the new node is a right
+		 child, so the number of combines is the number of trailing ones of the leaf index.
+		*/
+		s32				append_tree::append_leaf(hash_t const& _leaf)
+		{
+			if (length_ == capacity_)
+				return -4;	// full
+
+			bin_t bin(0, length_);
+			hash_t sig = at(bin);
+			copy(sig, _leaf);
+			while (bin.is_right())
+			{
+				bin_t const parent = bin.parent();
+				hash_t out = at(parent);
+				combine_f_(at(bin.sibling()), sig, out);
+				sig = out;
+				bin = parent;
+			}
+			length_ += 1;
+			return 0;
+		}
+
+		s32				append_tree::read(bin_t _bin, hash_t& _out_signature) const
+		{
+			if (!has(_bin, length_))
+				return -2;	// out of range
+			_out_signature = at(_bin);
+			return 0;
+		}
+
+		s32				append_tree::peaks(u64 _length, bin_t* _out_bins, hash_t* _out_signatures) const
+		{
+			if (_length > length_)
+				return -1;
+			s32 const count = gen_peaks(_length, _out_bins);
+			for (s32 i = 0; i < count; ++i)
+				_out_signatures[i] = at(_out_bins[i]);
+			return count;
+		}
+
+		bool			append_tree::root(bin_t& _out_root, hash_t& _out_signature) const
+		{
+			if (length_ == 0)
+				return false;
+
+			bin_t  bins[c_max_peaks + 1];
+			hash_t sigs[c_max_peaks];
+			s32 const count = peaks(length_, bins, sigs);
+
+			// the empty sub-tree signature lives on the stack, root() is const and may run concurrently
+			u8     empty_sig[c_max_siglen];
+			hash_t empty(empty_sig, siglen_);
+
+			_out_root = bin_t::to_root(length_);
+			fold_peaks(sigs, count, length_, empty, _out_signature, combine_f_);
+			return true;
+		}
+
+		/*
+		 The branch as ctree::read returns it, with the peak that covers the bin at @_length in the
+		 place of the root.
+		*/
+		s32				append_tree::read(bin_t _bin, u64 _length, branch_t& _branch) const
+		{
+			if (_length > length_ || !has(_bin, _length))
+				return -1;	// out of range
+
+			bin_t peaks[c_max_peaks + 1];
+			gen_peaks(_length, peaks);
+			s32 p = 0;
+			while (!peaks[p].contains(_bin))
+				p += 1;
+			bin_t const peak = peaks[p];
+
+			u32 const count = (_bin == peak) ? 1 : (u32)(peak.layer() - _bin.layer() + 2);
+			if ((_branch.length() - _branch.size()) < count)
+				return -2;
+
+			if (_bin != peak)
+			{
+				bin_t iter = _bin;
+				if (iter.is_right())
+					iter.to_sibling();
+
+				_branch.push(at(iter));
+				do
+				{
+					_branch.push(at(iter.sibling()));
+					iter.to_parent();
+				} while (iter != peak);
+			}
+			_branch.push(at(peak));
+			return _branch.size();
+		}
+
+		s32				append_tree::verify(bin_t _bin, branch_t const& _proof, bin_t const* _peaks, hash_t const* _peak_signatures, s32 _count, combine_f _sigcombiner)
+		{
+			s32 p = 0;
+			while (p < _count && !_peaks[p].contains(_bin))
+				p += 1;
+			if (p == _count)
+				return -2;	// not covered by the peaks
+
+			bin_t const peak = _peaks[p];
+			u32 const count = (_bin == peak) ? 1 : (u32)(peak.layer() - _bin.layer() + 2);
+			if (_proof.size() != count || _proof[0]->length_ != _peak_signatures[p].length_ || _proof[0]->length_ > c_max_siglen)
+				return -2;	// malformed
+
+			u8 digest[c_max_siglen];
+			hash_t work(digest, _proof[0]->length_);
+			copy(work, *_proof[0]);
+			if (_bin != peak)
+			{
+				_sigcombiner(*_proof[0], *_proof[1], work);
+				bin_t iter = _bin.parent();
+				for (u32 i = 2; i < count - 1; ++i)
+				{
+					if (iter.is_left())
+						_sigcombiner(work, *_proof[i], work);
+					else
+						_sigcombiner(*_proof[i], work, work);
+					iter.to_parent();
+				}
+			}
+
+			if (are_nequal(work, *_proof[count - 1]) || are_nequal(work, _peak_signatures[p]))
+				return -3;	// does not resolve to the peak
+			return -1;
+		}
 	}
 }
@@ -0,0 +1,272 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_file.h"
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+#	include <fcntl.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#elif defined(TARGET_PC)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#endif
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+namespace ncore
+{
+	namespace merkle
+	{
+		content_hasher::content_hasher(u32 _chunk_size, u32 _siglen, hash_chunk_f _hasher, parallel_for_f _parallel_for, void* _user)
+			: chunk_size_(_chunk_size)
+			, siglen_(_siglen)
+			, hasher_(_hasher)
+			, parallel_for_(_parallel_for)
+			, user_(_user)
+			, file_(-1)
+			, owned_(false)
+			, size_(0)
+		{
+			ASSERT(_chunk_size > 0 && _siglen <= c_max_siglen);
+		}
+
+		content_hasher::~content_hasher()
+		{
+			close();
+		}
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+
+		s32 content_hasher::open(const char* _path)
+		{
+			close();
+			int const fd = ::open(_path, O_RDONLY);
+			if (fd < 0)
+				return -1;
+			attach(fd);
+			owned_ = true;
+			if (file_ < 0)
+			{
+				::close(fd);
+				return -1;
+			}
+			return 0;
+		}
+
+		void content_hasher::attach(s64 _fd)
+		{
+			close();
+			struct stat st;
+			if (::fstat((int)_fd, &st) != 0)
+				return;
+			file_ = _fd;
+			size_ = (u64)st.st_size;
+		}
+
+		void content_hasher::close()
+		{
+			if (owned_ && file_ >= 0)
+				::close((int)file_);
+			file_  = -1;
+			owned_ = false;
+			size_  = 0;
+		}
+
+		s32 content_hasher::read_at(s64 _file, u64 _offset, u8* _dst, u32 _length)
+		{
+			while (_length > 0)
+			{
+				ssize_t const n = ::pread((int)_file, _dst, _length, (off_t)_offset);
+				if (n <= 0)
+					return -1;
+				_dst += n;
+				_offset += (u64)n;
+				_length -= (u32)n;
+			}
+			return 0;
+		}
+
+		void content_hasher::prefetch(s64 _file, u64 _offset, u64 _length)
+		{
+#if defined(TARGET_LINUX)
+			// the jobs read the chunks of a window in any order, so ask for the whole window up front
+			::posix_fadvise((int)_file, (off_t)_offset, (off_t)_length, POSIX_FADV_WILLNEED);
+#else
+			(void)_file;
+			(void)_offset;
+			(void)_length;
+#endif
+		}
+
+#elif defined(TARGET_PC)
+
+		s32 content_hasher::open(const char* _path)
+		{
+			close();
+			HANDLE fh = ::CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (fh == INVALID_HANDLE_VALUE)
+				return -1;
+			attach((s64)fh);
+			owned_ = true;
+			if (file_ == -1)
+			{
+				::CloseHandle(fh);
+				return -1;
+			}
+			return 0;
+		}
+
+		void content_hasher::attach(s64 _fd)
+		{
+			close();
+			LARGE_INTEGER size;
+			if (!::GetFileSizeEx((HANDLE)_fd, &size))
+				return;
+			file_ = _fd;
+			size_ = (u64)size.QuadPart;
+		}
+
+		void content_hasher::close()
+		{
+			if (owned_ && file_ != -1)
+				::CloseHandle((HANDLE)file_);
+			file_  = -1;
+			owned_ = false;
+			size_  = 0;
+		}
+
+		s32 content_hasher::read_at(s64 _file, u64 _offset, u8* _dst, u32 _length)
+		{
+			while (_length > 0)
+			{
+				OVERLAPPED ov;
+				nmem::memclr(&ov, sizeof(ov));
+				ov.Offset     = (DWORD)_offset;
+				ov.OffsetHigh = (DWORD)(_offset >> 32);
+				DWORD n = 0;
+				if (!::ReadFile((HANDLE)_file, _dst, _length, &n, &ov) || n == 0)
+					return -1;
+				_dst += n;
+				_offset += n;
+				_length -= n;
+			}
+			return 0;
+		}
+
+		void content_hasher::prefetch(s64, u64, u64)									{}
+
+#else
+
+		s32 content_hasher::open(const char*)										{ return -1; }
+		void content_hasher::attach(s64)											{}
+		void content_hasher::close()												{}
+		s32 content_hasher::read_at(s64, u64, u8*, u32)							{ return -1; }
+		void content_hasher::prefetch(s64, u64, u64)									{}
+
+#endif
+
+		namespace
+		{
+			struct hash_job_t
+			{
+				content_hasher const*	hasher_;
+				tree::builder*			builder_;
+				u8*						buffer_;
+				u64						first_;
+				u32						count_;			// chunks in the window
+				bin_t					pending_;		// the sub-tree of the previous window, built by job @count_
+				s32 volatile			result_;
+			};
+
+			// the jobs can fail concurrently, the result is only read after the parallel-for returned
+			static inline void fail(s32 volatile* _result, s32 _code)
+			{
+#if defined(_MSC_VER)
+				_InterlockedExchange((long volatile*)_result, _code);
+#else
+				__atomic_store_n(_result, _code, __ATOMIC_RELAXED);
+#endif
+			}
+		}
+
+		/*
+		 One chunk, read into its own slot of the window and hashed into its leaf.
+		 The job past the last chunk builds the sub-tree of the previous window, its leaves are
+		 all written, so it only touches signatures that the other jobs do not.
+		*/
+		void content_hasher::hash_job(void* _ctx, u32 _index)
+		{
+			hash_job_t* job = (hash_job_t*)_ctx;
+			content_hasher const* h = job->hasher_;
+			if (_index == job->count_)
+			{
+				job->builder_->build(job->pending_);
+				return;
+			}
+
+			u64 const chunk  = job->first_ + _index;
+			u64 const offset = chunk * h->chunk_size_;
+			u32 const length = (h->size_ - offset) < h->chunk_size_ ? (u32)(h->size_ - offset) : h->chunk_size_;
+			u8* const dst    = job->buffer_ + ((u64)_index * h->chunk_size_);
+			if (read_at(h->file_, offset, dst, length) != 0)
+			{
+				fail(&job->result_, -1);
+				return;
+			}
+
+			u8     digest[c_max_siglen];
+			hash_t sig(digest, h->siglen_);
+			h->hasher_(dst, length, sig);
+			job->builder_->write(bin_t(0, chunk), sig);
+		}
+
+		s32 content_hasher::hash(tree::builder& _builder, u8* _buffer, u64 _buffer_size)
+		{
+			bin_t const root = _builder.get_root();
+			u64 const chunks = get_chunks();
+			if (root.base_offset() != 0 || root.base_length() < chunks || _builder.get_siglen() != siglen_ || _buffer_size < chunk_size_)
+				return -2;
+
+			// a window is an aligned sub-tree, so it can be built as soon as its chunks are hashed
+			s32 layer = 0;
+			while ((((u64)2 << layer) * chunk_size_) <= _buffer_size && layer < root.layer())
+				layer += 1;
+			u64 const window = (u64)1 << layer;
+
+			hash_job_t job;
+			job.hasher_  = this;
+			job.builder_ = &_builder;
+			job.buffer_  = _buffer;
+			job.pending_ = bin_t::NONE;
+			job.result_  = 0;
+
+			// the sub-tree of window w is built by a job of window w+1, so it overlaps the reads and hashes of w+1
+			u64 const windows = root.base_length() >> layer;
+			for (u64 w = 0; w < windows; ++w)
+			{
+				job.first_ = w * window;
+				job.count_ = job.first_ >= chunks ? 0 : (u32)((chunks - job.first_) < window ? (chunks - job.first_) : window);
+				if (job.count_ > 0)
+					prefetch(file_, job.first_ * chunk_size_, (u64)job.count_ * chunk_size_);
+
+				u32 const jobs = job.count_ + (job.pending_.is_none() ? 0 : 1);
+				if (parallel_for_ != nullptr && jobs > 1)
+					parallel_for_(hash_job, &job, jobs, user_);
+				else
+					for (u32 i = 0; i < jobs; ++i)
+						hash_job(&job, i);
+				if (job.result_ != 0)
+					return job.result_;
+
+				job.pending_ = bin_t(layer, (root.base_offset() >> layer) + w);
+			}
+			_builder.build(job.pending_);
+			_builder.build_above(layer);
+			return 0;
+		}
+	}
+}
@@ -0,0 +1,291 @@
+#include "ccore/c_target.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_hash.h"
+
+namespace ncore
+{
+	// ----------------------------------------------------------------------------------------------------
+	// SHA-256 (FIPS 180-4)
+	// ----------------------------------------------------------------------------------------------------
+
+	static const u32 SHA256_K[64] =
+	{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static inline u32 rotr32(u32 x, s32 n)		{ return (x >> n) | (x << (32 - n)); }
+
+	static inline u32 load_be32(u8 const* p)	{ return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3]; }
+	static inline u32 load_le32(u8 const* p)	{ return ((u32)p[3] << 24) | ((u32)p[2] << 16) | ((u32)p[1] << 8) | (u32)p[0]; }
+
+	static inline void store_be32(u8* p, u32 v)	{ p[0] = (u8)(v >> 24); p[1] = (u8)(v >> 16); p[2] = (u8)(v >> 8); p[3] = (u8)v; }
+	static inline void store_le32(u8* p, u32 v)	{ p[0] = (u8)v; p[1] = (u8)(v >> 8); p[2] = (u8)(v >> 16); p[3] = (u8)(v >> 24); }
+
+	static void sha256_compress(sha256_state *S, u8 const* block)
+	{
+		u32 w[64];
+		for (s32 i = 0; i < 16; ++i)
+			w[i] = load_be32(block + i * 4);
+		for (s32 i = 16; i < 64; ++i)
+		{
+			u32 const s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			u32 const s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		u32 a = S->h[0], b = S->h[1], c = S->h[2], d = S->h[3];
+		u32 e = S->h[4], f = S->h[5], g = S->h[6], h = S->h[7];
+		for (s32 i = 0; i < 64; ++i)
+		{
+			u32 const s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+			u32 const ch = (e & f) ^ (~e & g);
+			u32 const t1 = h + s1 + ch + SHA256_K[i] + w[i];
+			u32 const s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+			u32 const mj = (a & b) ^ (a & c) ^ (b & c);
+			u32 const t2 = s0 + mj;
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		S->h[0] += a; S->h[1] += b; S->h[2] += c; S->h[3] += d;
+		S->h[4] += e; S->h[5] += f; S->h[6] += g; S->h[7] += h;
+	}
+
+	void sha256_init(sha256_state *S)
+	{
+		S->h[0] = 0x6a09e667; S->h[1] = 0xbb67ae85; S->h[2] = 0x3c6ef372; S->h[3] = 0xa54ff53a;
+		S->h[4] = 0x510e527f; S->h[5] = 0x9b05688c; S->h[6] = 0x1f83d9ab; S->h[7] = 0x5be0cd19;
+		S->length = 0;
+		S->buflen = 0;
+	}
+
+	void sha256_update(sha256_state *S, const u8 *in, u64 inlen)
+	{
+		S->length += inlen;
+		while (inlen > 0)
+		{
+			if (S->buflen == 0 && inlen >= 64)
+			{
+				sha256_compress(S, in);
+				in += 64;
+				inlen -= 64;
+				continue;
+			}
+			u32 n = 64 - S->buflen;
+			if ((u64)n > inlen)
+				n = (u32)inlen;
+			for (u32 i = 0; i < n; ++i)
+				S->buf[S->buflen + i] = in[i];
+			S->buflen += n;
+			in += n;
+			inlen -= n;
+			if (S->buflen == 64)
+			{
+				sha256_compress(S, S->buf);
+				S->buflen = 0;
+			}
+		}
+	}
+
+	void sha256_final(sha256_state *S, u8 *out)
+	{
+		u64 const bits = S->length * 8;
+		S->buf[S->buflen++] = 0x80;
+		if (S->buflen > 56)
+		{
+			while (S->buflen < 64)
+				S->buf[S->buflen++] = 0;
+			sha256_compress(S, S->buf);
+			S->buflen = 0;
+		}
+		while (S->buflen < 56)
+			S->buf[S->buflen++] = 0;
+		store_be32(S->buf + 56, (u32)(bits >> 32));
+		store_be32(S->buf + 60, (u32)bits);
+		sha256_compress(S, S->buf);
+
+		for (s32 i = 0; i < 8; ++i)
+			store_be32(out + i * 4, S->h[i]);
+	}
+
+	// ----------------------------------------------------------------------------------------------------
+	// BLAKE2s-256 (RFC 7693)
+	// ----------------------------------------------------------------------------------------------------
+
+	static const u32 BLAKE2S_IV[8] =
+	{
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+
+	static const u8 BLAKE2S_SIGMA[10][16] =
+	{
+		{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+		{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+		{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+		{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+		{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+		{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+		{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+		{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+		{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+		{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+	};
+
+	static void blake2s_compress(blake2s_state *S, u8 const* block, bool last)
+	{
+		u32 m[16];
+		u32 v[16];
+		for (s32 i = 0; i < 16; ++i)
+			m[i] = load_le32(block + i * 4);
+		for (s32 i = 0; i < 8; ++i)
+		{
+			v[i] = S->h[i];
+			v[i + 8] = BLAKE2S_IV[i];
+		}
+		v[12] ^= S->t[0];
+		v[13] ^= S->t[1];
+		if (last)
+			v[14] = ~v[14];
+
+#define BLAKE2S_G(a, b, c, d, x, y)			\
+		v[a] = v[a] + v[b] + x;				\
+		v[d] = rotr32(v[d] ^ v[a], 16);		\
+		v[c] = v[c] + v[d];					\
+		v[b] = rotr32(v[b] ^ v[c], 12);		\
+		v[a] = v[a] + v[b] + y;				\
+		v[d] = rotr32(v[d] ^ v[a], 8);		\
+		v[c] = v[c] + v[d];					\
+		v[b] = rotr32(v[b] ^ v[c], 7);
+
+		for (s32 r = 0; r < 10; ++r)
+		{
+			u8 const* s = BLAKE2S_SIGMA[r];
+			BLAKE2S_G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+			BLAKE2S_G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+			BLAKE2S_G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+			BLAKE2S_G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+			BLAKE2S_G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+			BLAKE2S_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+			BLAKE2S_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+			BLAKE2S_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+		}
+#undef BLAKE2S_G
+
+		for (s32 i = 0; i < 8; ++i)
+			S->h[i] ^= v[i] ^ v[i + 8];
+	}
+
+	static inline void blake2s_increment(blake2s_state *S, u32 n)
+	{
+		S->t[0] += n;
+		if (S->t[0] < n)
+			S->t[1] += 1;
+	}
+
+	void blake2s_init(blake2s_state *S)
+	{
+		for (s32 i = 0; i < 8; ++i)
+			S->h[i] = BLAKE2S_IV[i];
+		S->h[0] ^= 0x01010000 ^ 32;			// no key, 32 byte digest, fanout and depth 1
+		S->t[0] = 0;
+		S->t[1] = 0;
+		S->buflen = 0;
+	}
+
+	void blake2s_update(blake2s_state *S, const u8 *in, u64 inlen)
+	{
+		while (inlen > 0)
+		{
+			// the last block has to be compressed in final, so only compress a full buffer when more input follows
+			if (S->buflen == 64)
+			{
+				blake2s_increment(S, 64);
+				blake2s_compress(S, S->buf, false);
+				S->buflen = 0;
+			}
+			u32 n = 64 - S->buflen;
+			if ((u64)n > inlen)
+				n = (u32)inlen;
+			for (u32 i = 0; i < n; ++i)
+				S->buf[S->buflen + i] = in[i];
+			S->buflen += n;
+			in += n;
+			inlen -= n;
+		}
+	}
+
+	void blake2s_final(blake2s_state *S, u8 *out)
+	{
+		blake2s_increment(S, S->buflen);
+		while (S->buflen < 64)
+			S->buf[S->buflen++] = 0;
+		blake2s_compress(S, S->buf, true);
+
+		for (s32 i = 0; i < 8; ++i)
+			store_le32(out + i * 4, S->h[i]);
+	}
+
+	namespace merkle
+	{
+		void sha256_policy::combine(u8 const* _left, u8 const* _right, u8* _out)
+		{
+			sha256_state S;
+			sha256_init(&S);
+			sha256_update(&S, _left, c_digest_size);
+			sha256_update(&S, _right, c_digest_size);
+			sha256_final(&S, _out);
+		}
+
+		void sha256_policy::combine(u8 const* _left, u8 const* _right, u32 _length, u8* _out)
+		{
+			sha256_state S;
+			sha256_init(&S);
+			sha256_update(&S, _left, _length);
+			sha256_update(&S, _right, _length);
+			sha256_final(&S, _out);
+		}
+
+		void sha256_policy::combine_n(u8 const* const* _children, u32 _count, u8* _out)
+		{
+			sha256_state S;
+			sha256_init(&S);
+			for (u32 i = 0; i < _count; ++i)
+				sha256_update(&S, _children[i], c_digest_size);
+			sha256_final(&S, _out);
+		}
+
+		void blake2s_policy::combine(u8 const* _left, u8 const* _right, u8* _out)
+		{
+			blake2s_state S;
+			blake2s_init(&S);
+			blake2s_update(&S, _left, c_digest_size);
+			blake2s_update(&S, _right, c_digest_size);
+			blake2s_final(&S, _out);
+		}
+
+		void blake2s_policy::combine(u8 const* _left, u8 const* _right, u32 _length, u8* _out)
+		{
+			blake2s_state S;
+			blake2s_init(&S);
+			blake2s_update(&S, _left, _length);
+			blake2s_update(&S, _right, _length);
+			blake2s_final(&S, _out);
+		}
+
+		void blake2s_policy::combine_n(u8 const* const* _children, u32 _count, u8* _out)
+		{
+			blake2s_state S;
+			blake2s_init(&S);
+			for (u32 i = 0; i < _count; ++i)
+				blake2s_update(&S, _children[i], c_digest_size);
+			blake2s_final(&S, _out);
+		}
+	}
+}
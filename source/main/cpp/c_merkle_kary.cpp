@@ -0,0 +1,257 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_kary.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		static inline s32 log2_of(u32 _fanout)
+		{
+			s32 shift = 0;
+			while (((u32)1 << shift) < _fanout)
+				shift += 1;
+			return shift;
+		}
+
+		ktree::ktree(data_t& _data, u32 _fanout, combine_n_f _combiner)
+			: combine_n_f_(_combiner)
+			, shift_(log2_of(_fanout))
+			, levels_(0)
+			, root_bin_(0)
+			, data_(0)
+		{
+			ASSERT(_fanout == 2 || _fanout == 4 || _fanout == 8 || _fanout == 16);
+			ASSERT(_data.get_sparse() == nullptr);
+			ASSERT((_data.get_root().layer() % shift_) == 0);
+
+			root_bin_ = (bin_t*)_data.get_data();
+			*root_bin_ = _data.get_root();
+			levels_ = root_bin_->layer() / shift_;
+
+			data_ = _data.get_data() + sizeof(bin_t) + _data.get_siglen();
+			root_sig_ = hash_t(nullptr, _data.get_siglen());
+			root_sig_ = at(levels_, root_bin_->layer_offset());
+		}
+
+		ktree::ktree(data_t& _data, u32 _fanout, combine_n_f _combiner, hash_t const& _rootsig)
+			: combine_n_f_(_combiner)
+			, shift_(log2_of(_fanout))
+			, levels_(0)
+			, root_bin_(0)
+			, data_(0)
+		{
+			ASSERT(_fanout == 2 || _fanout == 4 || _fanout == 8 || _fanout == 16);
+			ASSERT(_data.get_sparse() == nullptr);
+			ASSERT((_data.get_root().layer() % shift_) == 0);
+
+			root_bin_ = (bin_t*)_data.get_data();
+			*root_bin_ = _data.get_root();
+			levels_ = root_bin_->layer() / shift_;
+
+			u64 const data_size = size_for(*root_bin_, _fanout, _data.get_siglen()) - sizeof(bin_t);
+			nmem::memclr(_data.get_data() + sizeof(bin_t), data_size);
+
+			data_ = _data.get_data() + sizeof(bin_t) + _data.get_siglen();
+			root_sig_ = hash_t(nullptr, _data.get_siglen());
+			root_sig_ = at(levels_, root_bin_->layer_offset());
+			nmem::memcpy(root_sig_.digest_, _rootsig.digest_, root_sig_.length_);
+		}
+
+		bin_t ktree::root_for(u64 _leaves, u32 _fanout)
+		{
+			s32 const shift = log2_of(_fanout);
+			s32 layer = 0;
+			while (layer < 63 && ((u64)1 << layer) < _leaves)
+				layer += shift;
+			return bin_t(layer, 0);
+		}
+
+		u64 ktree::size_for(bin_t _root, u32 _fanout, u32 _siglen)
+		{
+			s32 const shift = log2_of(_fanout);
+			u64 nodes = 0;
+			for (s32 layer = 0; layer <= _root.layer(); layer += shift)
+				nodes += _root.base_length() >> layer;
+			return sizeof(bin_t) + _siglen + (nodes * _siglen);
+		}
+
+		u32 ktree::proof_length(bin_t _root, u32 _fanout, bin_t _bin)
+		{
+			s32 const shift = log2_of(_fanout);
+			u32 const ancestors = (u32)((_root.layer() - _bin.layer()) / shift);
+			if (ancestors == 0)
+				return 0;
+			return _fanout + ((ancestors - 1) * (_fanout - 1));
+		}
+
+		bool ktree::is_node(bin_t _bin) const
+		{
+			return root_bin_->contains(_bin) && (_bin.layer() % shift_) == 0;
+		}
+
+		u64 ktree::index_of(s32 _level, u64 _offset) const
+		{
+			u64 index = 0;
+			for (s32 l = 0; l < _level; ++l)
+				index += root_bin_->base_length() >> (l * shift_);
+			return index + (_offset - (root_bin_->base_offset() >> (_level * shift_)));
+		}
+
+		s32 ktree::read(bin_t _bin, hash_t& _out_signature) const
+		{
+			if (!is_node(_bin))
+				return -2;
+			_out_signature = at(_bin.layer() / shift_, _bin.layer_offset());
+			return 0;
+		}
+
+		s32 ktree::read(bin_t _bin, branch_t& _proof) const
+		{
+			if (!is_node(_bin) || _bin == *root_bin_)
+				return -1;	// out of range
+
+			u32 const fanout = get_fanout();
+			if ((_proof.length() - _proof.size()) < proof_length(*root_bin_, fanout, _bin))
+				return -2;
+
+			s32 level = _bin.layer() / shift_;
+			u64 offset = _bin.layer_offset();
+			if (is_zero(at(level, offset)))
+				return -3;
+
+			u64 const first = offset & ~(u64)(fanout - 1);
+			for (u32 i = 0; i < fanout; ++i)
+				_proof.push(at(level, first + i));
+			for (level += 1, offset >>= shift_; level < levels_; ++level, offset >>= shift_)
+			{
+				u64 const group = offset & ~(u64)(fanout - 1);
+				for (u32 i = 0; i < fanout; ++i)
+				{
+					if ((group + i) != offset)
+						_proof.push(at(level, group + i));
+				}
+			}
+			return _proof.size();
+		}
+
+		/*
+		 Combine the proof up to the root, the signature of the ancestor at @_bin's level + 1 + k
+		 is written to scratch slot k.
+		*/
+		void ktree::resolve(bin_t _bin, branch_t const& _proof, u8* _scratch) const
+		{
+			u32 const siglen = root_sig_.length_;
+			u32 const fanout = get_fanout();
+
+			hash_t children[c_max_fanout];
+			for (u32 i = 0; i < fanout; ++i)
+				children[i] = *_proof[i];
+
+			hash_t work(_scratch, siglen);
+			combine_n_f_(children, fanout, work);
+
+			u32 next = fanout;
+			u64 offset = _bin.layer_offset() >> shift_;
+			for (s32 level = (_bin.layer() / shift_) + 1, k = 1; level < levels_; ++level, ++k, offset >>= shift_)
+			{
+				u32 const pos = (u32)(offset & (fanout - 1));
+				for (u32 i = 0; i < fanout; ++i)
+					children[i] = (i == pos) ? work : *_proof[next++];
+				hash_t parent(_scratch + ((u64)k * siglen), siglen);
+				combine_n_f_(children, fanout, parent);
+				work = parent;
+			}
+		}
+
+		s32 ktree::verify(bin_t _bin, branch_t const& _proof) const
+		{
+			if (!is_node(_bin) || _bin == *root_bin_ || root_sig_.length_ > c_max_siglen)
+				return -2;	// out of range
+			if (_proof.size() != proof_length(*root_bin_, get_fanout(), _bin))
+				return -2;	// malformed
+
+			u8 scratch[64 * c_max_siglen];
+			resolve(_bin, _proof, scratch);
+
+			s32 const ancestors = levels_ - (_bin.layer() / shift_);
+			hash_t const root(scratch + ((u64)(ancestors - 1) * root_sig_.length_), root_sig_.length_);
+			return are_equal(root, root_sig_) ? -1 : -3;
+		}
+
+		s32 ktree::write(bin_t _bin, branch_t const& _proof)
+		{
+			if (!is_node(_bin) || _bin == *root_bin_ || root_sig_.length_ > c_max_siglen)
+				return -2;	// out of range
+			if (_proof.size() != proof_length(*root_bin_, get_fanout(), _bin))
+				return -2;	// malformed
+
+			u8 scratch[64 * c_max_siglen];
+			resolve(_bin, _proof, scratch);
+
+			u32 const siglen = root_sig_.length_;
+			s32 const ancestors = levels_ - (_bin.layer() / shift_);
+			if (are_nequal(hash_t(scratch + ((u64)(ancestors - 1) * siglen), siglen), root_sig_))
+				return -3;
+
+			// The proof is valid, store the group, the siblings and the computed ancestors
+			u32 const fanout = get_fanout();
+			s32 level = _bin.layer() / shift_;
+			u64 offset = _bin.layer_offset();
+			u64 const first = offset & ~(u64)(fanout - 1);
+			for (u32 i = 0; i < fanout; ++i)
+				nmem::memcpy(at(level, first + i).digest_, _proof[i]->digest_, siglen);
+
+			u32 next = fanout;
+			for (s32 k = 0; k < ancestors - 1; ++k)
+			{
+				level += 1;
+				offset >>= shift_;
+				nmem::memcpy(at(level, offset).digest_, scratch + ((u64)k * siglen), siglen);
+				u64 const group = offset & ~(u64)(fanout - 1);
+				for (u32 i = 0; i < fanout; ++i)
+				{
+					if ((group + i) != offset)
+						nmem::memcpy(at(level, group + i).digest_, _proof[next++]->digest_, siglen);
+				}
+			}
+			return -1;
+		}
+
+		s32 ktree::write(bin_t _bin, hash_t const& _signature)
+		{
+			if (!is_node(_bin))
+				return -2;
+			nmem::memcpy(at(_bin.layer() / shift_, _bin.layer_offset()).digest_, _signature.digest_, root_sig_.length_);
+			return 0;
+		}
+
+		/*
+		 Level by level from the leaves up, the children of a node are consecutive
+		*/
+		hash_t const& ktree::build()
+		{
+			u32 const siglen = root_sig_.length_;
+			u32 const fanout = get_fanout();
+
+			hash_t children[c_max_fanout];
+			for (s32 level = 1; level <= levels_; ++level)
+			{
+				u64 const count = root_bin_->base_length() >> (level * shift_);
+				u8* child  = data_ + (index_of(level - 1, root_bin_->base_offset() >> ((level - 1) * shift_)) * siglen);
+				u8* parent = data_ + (index_of(level, root_bin_->base_offset() >> (level * shift_)) * siglen);
+				for (u64 o = 0; o < count; ++o)
+				{
+					for (u32 i = 0; i < fanout; ++i, child += siglen)
+						children[i] = hash_t(child, siglen);
+					hash_t out(parent, siglen);
+					combine_n_f_(children, fanout, out);
+					parent += siglen;
+				}
+			}
+			return root_sig_;
+		}
+	}
+}
@@ -0,0 +1,389 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_lazy.h"
+#include "cbinmaps/c_utils.h"
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+namespace ncore
+{
+	namespace merkle
+	{
+		namespace
+		{
+			static const u32 c_nil = 0xFFFFFFFF;
+
+			// a stripe header has a cache line of its own, so the locks of the stripes do not share lines
+			struct stripe_t
+			{
+				u32 volatile	lock_;
+				u32				head_;		// most recently used
+				u32				tail_;		// least recently used
+				u32				count_;
+				u64				hits_;
+				u64				misses_;
+				u8				pad_[32];
+			};
+
+			struct entry_t
+			{
+				u64				key_;
+				u32				prev_;
+				u32				next_;
+				u32				chain_;		// next entry in the same bucket
+				u32				pad_;
+			};
+
+			static inline void lock(u32 volatile* _lock)
+			{
+#if defined(_MSC_VER)
+				while (_InterlockedExchange((long volatile*)_lock, 1) != 0)
+					while (*_lock != 0) {}
+#else
+				while (__atomic_exchange_n(_lock, 1, __ATOMIC_ACQUIRE) != 0)
+					while (__atomic_load_n(_lock, __ATOMIC_RELAXED) != 0) {}
+#endif
+			}
+
+			static inline void unlock(u32 volatile* _lock)
+			{
+#if defined(_MSC_VER)
+				_InterlockedExchange((long volatile*)_lock, 0);
+#else
+				__atomic_store_n(_lock, 0, __ATOMIC_RELEASE);
+#endif
+			}
+
+			static inline u64 align8(u64 _size)		{ return (_size + 7) & ~(u64)7; }
+
+			static inline u32 buckets_for(u32 _entries)
+			{
+				u32 buckets = 1;
+				while (buckets < _entries)
+					buckets <<= 1;
+				return buckets;
+			}
+
+			static inline void lru_unlink(stripe_t* _stripe, entry_t* _entries, u32 _e)
+			{
+				entry_t& e = _entries[_e];
+				if (e.prev_ != c_nil) _entries[e.prev_].next_ = e.next_;
+				else _stripe->head_ = e.next_;
+				if (e.next_ != c_nil) _entries[e.next_].prev_ = e.prev_;
+				else _stripe->tail_ = e.prev_;
+			}
+
+			static inline void lru_push_front(stripe_t* _stripe, entry_t* _entries, u32 _e)
+			{
+				entry_t& e = _entries[_e];
+				e.prev_ = c_nil;
+				e.next_ = _stripe->head_;
+				if (_stripe->head_ != c_nil) _entries[_stripe->head_].prev_ = _e;
+				else _stripe->tail_ = _e;
+				_stripe->head_ = _e;
+			}
+		}
+
+		lru_cache::lru_cache(u32 _siglen, u32 _stripes, u32 _entries, u8* _data)
+			: siglen_(_siglen)
+			, stripes_(_stripes)
+			, entries_(_entries)
+			, buckets_(buckets_for(_entries))
+			, block_size_(0)
+			, data_(_data)
+		{
+			ASSERT(sizeof(stripe_t) == 64 && sizeof(entry_t) == 24);
+			ASSERT(_stripes > 0 && (_stripes & (_stripes - 1)) == 0 && _stripes <= 65536);
+			ASSERT(_entries > 0 && _siglen <= c_max_siglen);
+			block_size_ = size_for(_siglen, 1, _entries) - sizeof(stripe_t);
+			clear();
+		}
+
+		u64 lru_cache::size_for(u32 _siglen, u32 _stripes, u32 _entries)
+		{
+			u64 const block = align8((u64)buckets_for(_entries) * sizeof(u32)) + ((u64)_entries * sizeof(entry_t)) + align8((u64)_entries * _siglen);
+			return (u64)_stripes * (sizeof(stripe_t) + block);
+		}
+
+		void lru_cache::clear()
+		{
+			for (u32 s = 0; s < stripes_; ++s)
+			{
+				stripe_t* stripe = (stripe_t*)stripe_of(s);
+				nmem::memclr(stripe, sizeof(stripe_t));
+				stripe->head_ = c_nil;
+				stripe->tail_ = c_nil;
+				u32* buckets = (u32*)block_of(s);
+				for (u32 b = 0; b < buckets_; ++b)
+					buckets[b] = c_nil;
+			}
+		}
+
+		/*
+		 The low bits of the hash select the stripe, the bits above them the bucket, so the bins of
+		 one stripe still spread over all of its buckets.
+		*/
+		bool lru_cache::find(bin_t _bin, u8* _out_signature)
+		{
+			u64 const h = hash_of(_bin);
+			u32 const s = (u32)h & (stripes_ - 1);
+			stripe_t* stripe = (stripe_t*)stripe_of(s);
+			u8* const block = block_of(s);
+			u32* const buckets = (u32*)block;
+			entry_t* const entries = (entry_t*)(block + align8((u64)buckets_ * sizeof(u32)));
+			u8* const digests = (u8*)(entries + entries_);
+
+			lock(&stripe->lock_);
+			u32 e = buckets[(u32)(h >> 16) & (buckets_ - 1)];
+			while (e != c_nil && entries[e].key_ != _bin.value())
+				e = entries[e].chain_;
+			if (e == c_nil)
+			{
+				stripe->misses_ += 1;
+				unlock(&stripe->lock_);
+				return false;
+			}
+			lru_unlink(stripe, entries, e);
+			lru_push_front(stripe, entries, e);
+			g_memcopy4((u32*)_out_signature, (u32 const*)(digests + ((u64)e * siglen_)), siglen_ / 4);
+			stripe->hits_ += 1;
+			unlock(&stripe->lock_);
+			return true;
+		}
+
+		/*
+		 A full stripe reuses its least recently used entry, which first has to be taken out of the
+		 chain of its bucket. Another reader can have inserted the same bin in the meantime, then the
+		 entry is only refreshed.
+		*/
+		void lru_cache::insert(bin_t _bin, u8 const* _signature)
+		{
+			u64 const h = hash_of(_bin);
+			u32 const s = (u32)h & (stripes_ - 1);
+			stripe_t* stripe = (stripe_t*)stripe_of(s);
+			u8* const block = block_of(s);
+			u32* const buckets = (u32*)block;
+			entry_t* const entries = (entry_t*)(block + align8((u64)buckets_ * sizeof(u32)));
+			u8* const digests = (u8*)(entries + entries_);
+			u32* const bucket = &buckets[(u32)(h >> 16) & (buckets_ - 1)];
+
+			lock(&stripe->lock_);
+			u32 e = *bucket;
+			while (e != c_nil && entries[e].key_ != _bin.value())
+				e = entries[e].chain_;
+			if (e != c_nil)
+			{
+				lru_unlink(stripe, entries, e);
+			}
+			else
+			{
+				if (stripe->count_ < entries_)
+				{
+					e = stripe->count_++;
+				}
+				else
+				{
+					e = stripe->tail_;
+					lru_unlink(stripe, entries, e);
+					u32* link = &buckets[(u32)(hash_of(bin_t(entries[e].key_)) >> 16) & (buckets_ - 1)];
+					while (*link != e)
+						link = &entries[*link].chain_;
+					*link = entries[e].chain_;
+				}
+				entries[e].key_   = _bin.value();
+				entries[e].chain_ = *bucket;
+				*bucket = e;
+			}
+			lru_push_front(stripe, entries, e);
+			g_memcopy4((u32*)(digests + ((u64)e * siglen_)), (u32 const*)_signature, siglen_ / 4);
+			unlock(&stripe->lock_);
+		}
+
+		u64 lru_cache::hits() const
+		{
+			u64 hits = 0;
+			for (u32 s = 0; s < stripes_; ++s)
+				hits += ((stripe_t const*)stripe_of(s))->hits_;
+			return hits;
+		}
+
+		u64 lru_cache::misses() const
+		{
+			u64 misses = 0;
+			for (u32 s = 0; s < stripes_; ++s)
+				misses += ((stripe_t const*)stripe_of(s))->misses_;
+			return misses;
+		}
+
+		void lru_cache::reset_counters()
+		{
+			for (u32 s = 0; s < stripes_; ++s)
+			{
+				stripe_t* stripe = (stripe_t*)stripe_of(s);
+				lock(&stripe->lock_);
+				stripe->hits_   = 0;
+				stripe->misses_ = 0;
+				unlock(&stripe->lock_);
+			}
+		}
+
+		// data: [bin_t root][leaves][top layers, layer by layer from the lowest stored layer up to the root]
+		lazy_tree::lazy_tree(data_t& _data, s32 _top_layers, combine_f _sigcombiner, lru_cache* _cache)
+			: combine_f_(_sigcombiner)
+			, cache_(_cache)
+			, root_bin_(0)
+			, top_layer_(0)
+			, siglen_(_data.get_siglen())
+			, leaves_(0)
+			, top_(0)
+		{
+			ASSERT(_data.get_sparse() == nullptr && _top_layers >= 0 && siglen_ <= c_max_siglen);
+			root_bin_ = (bin_t*)_data.get_data();
+			*root_bin_ = _data.get_root();
+			s32 const layers = _top_layers < root_bin_->layer() ? _top_layers : root_bin_->layer();
+			top_layer_ = root_bin_->layer() - layers + 1;
+			leaves_ = _data.get_data() + sizeof(bin_t);
+			top_ = leaves_ + (root_bin_->base_length() * siglen_);
+		}
+
+		u64 lazy_tree::size_for(bin_t _root, u32 _siglen, s32 _top_layers)
+		{
+			s32 const layers = _top_layers < _root.layer() ? _top_layers : _root.layer();
+			u64 const top = ((u64)1 << layers) - 1;
+			return sizeof(bin_t) + ((_root.base_length() + top) * _siglen);
+		}
+
+		u8* lazy_tree::top(bin_t _bin) const
+		{
+			// the layers below the layer of @_bin hold 2 * ((B >> top_layer_) - (B >> layer)) nodes
+			u64 const base = root_bin_->base_length();
+			s32 const layer = _bin.layer();
+			u64 const index = (2 * ((base >> top_layer_) - (base >> layer))) + (_bin.layer_offset() - (root_bin_->base_offset() >> layer));
+			return top_ + (index * siglen_);
+		}
+
+		s32 lazy_tree::write(bin_t _bin, hash_t const& _signature)
+		{
+			if (!_bin.is_base() || !root_bin_->contains(_bin))
+				return -1;
+			ASSERT(_signature.length_ == siglen_);
+			g_memcopy4((u32*)leaf(_bin.base_offset()), (u32 const*)_signature.digest_, siglen_ / 4);
+			return 0;
+		}
+
+		/*
+		 The lowest stored layer is computed from the leaves, every layer above it from the layer below.
+		*/
+		void lazy_tree::build()
+		{
+			s32 const root_layer = root_bin_->layer();
+			if (top_layer_ > root_layer)
+				return;	// the root is a leaf
+
+			u64 const first = root_bin_->base_offset() >> top_layer_;
+			u64 const count = root_bin_->base_length() >> top_layer_;
+			for (u64 i = 0; i < count; ++i)
+			{
+				bin_t const bin(top_layer_, first + i);
+				compute(bin, top(bin));
+			}
+
+			for (s32 layer = top_layer_ + 1; layer <= root_layer; ++layer)
+			{
+				u64 const lfirst = root_bin_->base_offset() >> layer;
+				u64 const lcount = root_bin_->base_length() >> layer;
+				for (u64 i = 0; i < lcount; ++i)
+				{
+					bin_t const bin(layer, lfirst + i);
+					hash_t const left(top(bin.left()), siglen_);
+					hash_t const right(top(bin.right()), siglen_);
+					hash_t out(top(bin), siglen_);
+					combine_f_(left, right, out);
+				}
+			}
+		}
+
+		void lazy_tree::compute(bin_t _bin, u8* _out) const
+		{
+			if (_bin.is_base())
+			{
+				g_memcopy4((u32*)_out, (u32 const*)leaf(_bin.base_offset()), siglen_ / 4);
+				return;
+			}
+
+			u8 left[c_max_siglen];
+			u8 right[c_max_siglen];
+			compute(_bin.left(), left);
+			compute(_bin.right(), right);
+			hash_t const l(left, siglen_);
+			hash_t const r(right, siglen_);
+			hash_t out(_out, siglen_);
+			combine_f_(l, r, out);
+		}
+
+		void lazy_tree::node(bin_t _bin, u8* _out) const
+		{
+			if (_bin.is_base())
+			{
+				g_memcopy4((u32*)_out, (u32 const*)leaf(_bin.base_offset()), siglen_ / 4);
+				return;
+			}
+			if (_bin.layer() >= top_layer_)
+			{
+				g_memcopy4((u32*)_out, (u32 const*)top(_bin), siglen_ / 4);
+				return;
+			}
+			if (cache_ != nullptr && cache_->find(_bin, _out))
+				return;
+			compute(_bin, _out);
+			if (cache_ != nullptr)
+				cache_->insert(_bin, _out);
+		}
+
+		s32 lazy_tree::read(bin_t _bin, hash_t& _out_signature) const
+		{
+			if (!root_bin_->contains(_bin))
+				return -1;	// out of range
+			ASSERT(_out_signature.digest_ != nullptr && _out_signature.length_ == siglen_);
+			node(_bin, _out_signature.digest_);
+			return 0;
+		}
+
+		s32 lazy_tree::read(bin_t _bin, branch_t& _branch) const
+		{
+			if (!root_bin_->contains(_bin))
+				return -1;	// out of range
+
+			// is there enough space in the destination to write the full branch (base pair, uncles and root)?
+			if ((_branch.length() - _branch.size()) < (u32)(root_bin_->layer() - _bin.layer() + 2))
+				return -2;
+
+			u8 digest[c_max_siglen];
+			hash_t const sig(digest, siglen_);
+
+			if (_bin != *root_bin_)
+			{
+				bin_t iter = _bin;
+				if (iter.is_right())
+					iter.to_sibling();
+
+				node(iter, digest);
+				_branch.push(sig);
+				do
+				{
+					node(iter.sibling(), digest);
+					_branch.push(sig);
+					iter.to_parent();
+				} while (iter != *root_bin_);
+			}
+			node(*root_bin_, digest);
+			_branch.push(sig);
+
+			return _branch.size();
+		}
+	}
+}
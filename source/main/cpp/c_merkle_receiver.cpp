@@ -0,0 +1,179 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_receiver.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		receiver::receiver(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, hash_chunk_f _hasher, binmaps::binmap& _have, u8* _scratch, u64 _scratch_size, combine_batch_f _batchcombiner)
+			: tree(_data, _rootsig, _sigcombiner, _batchcombiner)
+			, hasher_(_hasher)
+			, have_(&_have)
+			, branches_((hash_t*)_scratch)
+			, ancestors_(0)
+			, scratch_chunks_((u32)(_scratch_size / scratch_size(_data.get_root(), _data.get_siglen(), 1)))
+		{
+			ASSERT(_have.root().contains(_data.get_root()));
+			ASSERT(((uint_t)_scratch & 7) == 0 && scratch_chunks_ > 0);
+			ancestors_ = _scratch + ((u64)scratch_chunks_ * branch_length() * sizeof(hash_t));
+		}
+
+		/*
+		 The signatures of the proof with the leaf of the chunk replaced by the computed signature,
+		 only the hash_t's are copied, return: the number of signatures
+		*/
+		u32 receiver::substitute(chunk_t const& _chunk, hash_t* _array) const
+		{
+			branch_t const& proof = *_chunk.proof_;
+			u32 const size = proof.size();
+			ASSERT(size <= branch_length());
+			for (u32 i = 0; i < size; ++i)
+				_array[i] = *proof[i];
+			if (size >= 2)
+				_array[_chunk.bin_.is_left() ? 0 : 1] = hash_t((u8*)_chunk.digest_, _array[0].length_);
+			return size;
+		}
+
+		s32 receiver::accept_chunk(bin_t _bin, u8 const* _bytes, u32 _length, branch_t const& _proof)
+		{
+			chunk_t chunk;
+			chunk.bin_    = _bin;
+			chunk.bytes_  = _bytes;
+			chunk.length_ = _length;
+			chunk.proof_  = &_proof;
+			chunk.result_ = 0;
+			hash_and_verify(&chunk, 1, 0);
+			if (chunk.result_ != -1)
+				return chunk.result_;
+
+			branch_t const branch(branch_at(0), _proof.size(), _proof.size());
+			if (!has_room(2 * (u32)(root_bin_->layer() + 1)))
+				return -4;	// full
+			store(_bin, branch, ancestors_at(0));
+			have_->set(_bin);
+			return -1;
+		}
+
+		/*
+		 Hash the chunks and verify their branches, only reads the tree and the have-map so any
+		 number of jobs can run at the same time. The branches and the verified ancestors of the chunks
+		 are kept in the scratch from @_slot on, at most c_combine_batch_size of them are verified at once.
+		*/
+		void receiver::hash_and_verify(chunk_t* _chunks, u32 _count, u32 _slot) const
+		{
+			u32 const siglen = root_sig_.length_;
+			u32 const length = branch_length();
+
+			branch_t branches[c_combine_batch_size];
+			verify_t items[c_combine_batch_size];
+			chunk_t* owners[c_combine_batch_size];
+
+			for (u32 begin = 0; begin < _count; begin += c_combine_batch_size)
+			{
+				u32 const end = (begin + c_combine_batch_size) < _count ? (begin + c_combine_batch_size) : _count;
+
+				u32 n = 0;
+				for (u32 i = begin; i < end; ++i)
+				{
+					chunk_t& chunk = _chunks[i];
+					if (!chunk.bin_.is_base() || !root_bin_->contains(chunk.bin_) || chunk.proof_->size() < 2 || chunk.proof_->size() > length || siglen > c_max_siglen)
+					{
+						chunk.result_ = -2;	// out of range or malformed
+						continue;
+					}
+					if (have_->is_filled(chunk.bin_))
+					{
+						chunk.result_ = 0;	// already have it
+						continue;
+					}
+
+					hash_t sig(chunk.digest_, siglen);
+					hasher_(chunk.bytes_, chunk.length_, sig);
+
+					hash_t* const array = branch_at(_slot + i);
+					u32 const size = substitute(chunk, array);
+					branches[n] = branch_t(array, size, size);
+					items[n].bin_       = chunk.bin_;
+					items[n].branch_    = &branches[n];
+					items[n].result_    = 0;
+					items[n].ancestors_ = ancestors_at(_slot + i);
+					owners[n] = &chunk;
+					n += 1;
+				}
+
+				verify(items, n);
+				for (u32 k = 0; k < n; ++k)
+					owners[k]->result_ = items[k].result_;
+			}
+		}
+
+		namespace
+		{
+			struct accept_job_t
+			{
+				receiver const*	receiver_;
+				chunk_t*		chunks_;
+				u32				count_;
+				u32				per_job_;
+			};
+		}
+
+		void receiver::accept_job(void* _ctx, u32 _index)
+		{
+			accept_job_t const* job = (accept_job_t const*)_ctx;
+			u32 const begin = _index * job->per_job_;
+			u32 const end = (begin + job->per_job_) < job->count_ ? (begin + job->per_job_) : job->count_;
+			job->receiver_->hash_and_verify(job->chunks_ + begin, end - begin, begin);
+		}
+
+		u32 receiver::accept_chunks(chunk_t* _chunks, u32 _count, parallel_for_f _parallel_for, void* _user)
+		{
+			if (_count == 0)
+				return 0;
+
+			// every chunk of a round has its own branch and ancestors in the scratch, the accepted
+			// chunks of a round are stored before the next round reuses the scratch
+			accept_job_t job;
+			job.receiver_ = this;
+			job.per_job_  = scratch_chunks_ < c_combine_batch_size ? scratch_chunks_ : c_combine_batch_size;
+			u32 accepted = 0;
+			for (u32 begin = 0; begin < _count; begin += scratch_chunks_)
+			{
+				job.chunks_ = _chunks + begin;
+				job.count_  = (_count - begin) < scratch_chunks_ ? (_count - begin) : scratch_chunks_;
+				u32 const jobs = (job.count_ + job.per_job_ - 1) / job.per_job_;
+				if (_parallel_for != nullptr && jobs > 1)
+					_parallel_for(accept_job, &job, jobs, _user);
+				else
+					for (u32 j = 0; j < jobs; ++j)
+						accept_job(&job, j);
+
+				// a burst can hold the same chunk twice, only the first one is stored
+				for (u32 i = 0; i < job.count_; ++i)
+				{
+					chunk_t& chunk = job.chunks_[i];
+					if (chunk.result_ != -1)
+						continue;
+					if (have_->is_filled(chunk.bin_))
+					{
+						chunk.result_ = 0;
+						continue;
+					}
+					if (!has_room(2 * (u32)(root_bin_->layer() + 1)))
+					{
+						chunk.result_ = -4;	// full
+						continue;
+					}
+					branch_t const branch(branch_at(i), chunk.proof_->size(), chunk.proof_->size());
+					store(chunk.bin_, branch, ancestors_at(i));
+					have_->set(chunk.bin_);
+					accepted += 1;
+				}
+			}
+			return accepted;
+		}
+	}
+}
@@ -0,0 +1,286 @@
+#include "ccore/c_target.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+
+#include "cbinmaps/c_merkle_store.h"
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#elif defined(TARGET_PC)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#endif
+
+namespace ncore
+{
+	namespace merkle
+	{
+		store_t::store_t()
+			: header_(0)
+			, mapping_(0)
+			, size_(0)
+			, file_(-1)
+#if defined(TARGET_PC)
+			, map_handle_(0)
+#endif
+		{
+		}
+
+		store_t::~store_t()
+		{
+			close();
+		}
+
+		data_t			store_t::data() const
+		{
+			ASSERT(is_open());
+			return data_t(get_root(), get_siglen(), mapping_ + store_header_t::c_size, (elayout)header_->layout_);
+		}
+
+		// the header is only trusted after this, a corrupt header could otherwise make data() index outside the mapping
+		static bool		is_valid_header(store_header_t const& _header, u64 _file_size)
+		{
+			if (_header.magic_ != store_header_t::c_magic || _header.version_ != store_header_t::c_version)
+				return false;
+			if (_header.layout_ != (u32)LAYOUT_INORDER && _header.layout_ != (u32)LAYOUT_LAYER_MAJOR)
+				return false;
+			if (_header.siglen_ == 0 || _header.siglen_ > c_max_siglen || (_header.siglen_ % 4) != 0)
+				return false;
+			return _header.data_size_ == data_t::size_for(bin_t(_header.root_), _header.siglen_) && _file_size == (store_header_t::c_size + _header.data_size_);
+		}
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+
+		s32				store_t::map(u64 _size, bool _readonly)
+		{
+			// a read-only store is mapped private, the few bytes that a ctree writes (the root bin) stay in memory
+			s32 const flags = _readonly ? MAP_PRIVATE : MAP_SHARED;
+			void* mem = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, flags, (int)file_, 0);
+			if (mem == MAP_FAILED)
+				return -1;
+
+			// proofs touch a few signatures per layer, read-ahead would only pollute the page cache
+			::madvise(mem, _size, MADV_RANDOM);
+
+			mapping_ = (u8*)mem;
+			size_    = _size;
+			header_  = (store_header_t*)mem;
+			return 0;
+		}
+
+		s32				store_t::create(const char* _path, bin_t _root, u32 _siglen, u32 _algorithm, elayout _layout)
+		{
+			close();
+
+			int const fd = ::open(_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				return -1;
+			file_ = fd;
+
+			// the file is sparse, the signatures occupy disk space when they are written
+			u64 const data_size = data_t::size_for(_root, _siglen);
+			u64 const size = store_header_t::c_size + data_size;
+			if (::ftruncate(fd, (off_t)size) != 0 || map(size, false) != 0)
+			{
+				close();
+				return -1;
+			}
+
+			header_->magic_     = store_header_t::c_magic;
+			header_->version_   = store_header_t::c_version;
+			header_->algorithm_ = _algorithm;
+			header_->siglen_    = _siglen;
+			header_->layout_    = (u32)_layout;
+			header_->reserved_  = 0;
+			header_->root_      = _root.value();
+			header_->data_size_ = data_size;
+			*(bin_t*)(mapping_ + store_header_t::c_size) = _root;
+			return 0;
+		}
+
+		s32				store_t::open(const char* _path, u32 _algorithm, bool _readonly)
+		{
+			close();
+
+			int const fd = ::open(_path, _readonly ? O_RDONLY : O_RDWR);
+			if (fd < 0)
+				return -1;
+			file_ = fd;
+
+			store_header_t header;
+			struct stat st;
+			if (::fstat(fd, &st) != 0 || ::pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+			{
+				close();
+				return -1;
+			}
+
+			if (!is_valid_header(header, (u64)st.st_size))
+			{
+				close();
+				return -2;
+			}
+			if (header.algorithm_ != _algorithm)
+			{
+				close();
+				return -3;
+			}
+
+			if (map((u64)st.st_size, _readonly) != 0)
+			{
+				close();
+				return -1;
+			}
+			return 0;
+		}
+
+		s32				store_t::flush()
+		{
+			if (!is_open())
+				return -1;
+			if (::msync(mapping_, size_, MS_SYNC) != 0)
+				return -1;
+			return 0;
+		}
+
+		void			store_t::close()
+		{
+			if (mapping_ != nullptr)
+				::munmap(mapping_, size_);
+			if (file_ >= 0)
+				::close((int)file_);
+			header_  = nullptr;
+			mapping_ = nullptr;
+			size_    = 0;
+			file_    = -1;
+		}
+
+#elif defined(TARGET_PC)
+
+		s32				store_t::map(u64 _size, bool _readonly)
+		{
+			DWORD const protect = _readonly ? PAGE_WRITECOPY : PAGE_READWRITE;
+			HANDLE mh = ::CreateFileMappingA((HANDLE)file_, nullptr, protect, (DWORD)(_size >> 32), (DWORD)_size, nullptr);
+			if (mh == nullptr)
+				return -1;
+
+			DWORD const access = _readonly ? FILE_MAP_COPY : FILE_MAP_WRITE;
+			void* mem = ::MapViewOfFile(mh, access, 0, 0, (SIZE_T)_size);
+			if (mem == nullptr)
+			{
+				::CloseHandle(mh);
+				return -1;
+			}
+
+			map_handle_ = mh;
+			mapping_    = (u8*)mem;
+			size_       = _size;
+			header_     = (store_header_t*)mem;
+			return 0;
+		}
+
+		s32				store_t::create(const char* _path, bin_t _root, u32 _siglen, u32 _algorithm, elayout _layout)
+		{
+			close();
+
+			HANDLE fh = ::CreateFileA(_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+			if (fh == INVALID_HANDLE_VALUE)
+				return -1;
+			file_ = (s64)fh;
+
+			u64 const data_size = data_t::size_for(_root, _siglen);
+			u64 const size = store_header_t::c_size + data_size;
+			if (map(size, false) != 0)
+			{
+				close();
+				return -1;
+			}
+
+			header_->magic_     = store_header_t::c_magic;
+			header_->version_   = store_header_t::c_version;
+			header_->algorithm_ = _algorithm;
+			header_->siglen_    = _siglen;
+			header_->layout_    = (u32)_layout;
+			header_->reserved_  = 0;
+			header_->root_      = _root.value();
+			header_->data_size_ = data_size;
+			*(bin_t*)(mapping_ + store_header_t::c_size) = _root;
+			return 0;
+		}
+
+		s32				store_t::open(const char* _path, u32 _algorithm, bool _readonly)
+		{
+			close();
+
+			DWORD const access = _readonly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+			HANDLE fh = ::CreateFileA(_path, access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+			if (fh == INVALID_HANDLE_VALUE)
+				return -1;
+			file_ = (s64)fh;
+
+			store_header_t header;
+			DWORD read = 0;
+			LARGE_INTEGER size;
+			if (!::GetFileSizeEx(fh, &size) || !::ReadFile(fh, &header, sizeof(header), &read, nullptr) || read != sizeof(header))
+			{
+				close();
+				return -1;
+			}
+
+			if (!is_valid_header(header, (u64)size.QuadPart))
+			{
+				close();
+				return -2;
+			}
+			if (header.algorithm_ != _algorithm)
+			{
+				close();
+				return -3;
+			}
+
+			if (map((u64)size.QuadPart, _readonly) != 0)
+			{
+				close();
+				return -1;
+			}
+			return 0;
+		}
+
+		s32				store_t::flush()
+		{
+			if (!is_open())
+				return -1;
+			if (!::FlushViewOfFile(mapping_, 0) || !::FlushFileBuffers((HANDLE)file_))
+				return -1;
+			return 0;
+		}
+
+		void			store_t::close()
+		{
+			if (mapping_ != nullptr)
+				::UnmapViewOfFile(mapping_);
+			if (map_handle_ != nullptr)
+				::CloseHandle((HANDLE)map_handle_);
+			if (file_ != -1)
+				::CloseHandle((HANDLE)file_);
+			header_     = nullptr;
+			mapping_    = nullptr;
+			map_handle_ = nullptr;
+			size_       = 0;
+			file_       = -1;
+		}
+
+#else
+
+		s32				store_t::map(u64, bool)												{ return -1; }
+		s32				store_t::create(const char*, bin_t, u32, u32, elayout)				{ return -1; }
+		s32				store_t::open(const char*, u32, bool)								{ return -1; }
+		s32				store_t::flush()													{ return -1; }
+		void			store_t::close()													{}
+
+#endif
+	}
+}
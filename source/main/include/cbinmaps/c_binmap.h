@@ -19,9 +19,15 @@ namespace ncore
 		public:
 							binmap();
 							binmap(bin_t root, byte* data);
+							binmap(u64 length, byte* data);
 							binmap(const binmap&);
 
+			static u64		size_for(bin_t root);
+			static u64		size_for(u64 length);
+
 			bin_t const&	root() const;
+			u64				length() const;
+			s32				peaks(bin_t* peaks) const;
 
 			bool			is_empty() const;
 			bool			is_filled() const;
@@ -36,10 +42,14 @@ namespace ncore
 			bin_t			find_filled() const;
 			bin_t			find_empty(bin_t start) const;
 
-			uint_t			total_size() const;
+			bin_t			find_empty_run(u64 min_length, u64 from) const;
+			bin_t			find_filled_run(u64 min_length, u64 from) const;
+
+			u64				total_size() const;
 
 			bool			read_am_at(bin_t) const;
 			bool			read_om_at(bin_t) const;
+			bool			is_past_end(bin_t) const;
 
 			void			clear();
 			void			fill();
@@ -47,6 +57,8 @@ namespace ncore
 			void			set(const bin_t& bin);
 			void			reset(const bin_t& bin);
 
+			void			grow(bin_t root, byte* data);
+
 		protected:
 			s32				write_am_at(bin_t, bool);
 			bool			xchg_am_at(bin_t, bool);
@@ -54,11 +66,48 @@ namespace ncore
 			s32				write_om_at(bin_t, bool);
 			bool			xchg_om_at(bin_t, bool);
 
+			// An exact-length binmap runs the same algorithms with accessors that keep the bins
+			// past the end in the spine, so the accessors above never have to check for the end.
+			bool			is_exact() const				{ return length_ != binroot_->base_length(); }
+			bool			straddles_end(bin_t) const;
+
+			template <bool Exact> bool		read_am(bin_t) const;
+			template <bool Exact> bool		read_om(bin_t) const;
+			template <bool Exact> void		write_am(bin_t, bool);
+			template <bool Exact> void		write_om(bin_t, bool);
+			template <bool Exact> bool		xchg_am(bin_t, bool);
+			template <bool Exact> bool		xchg_om(bin_t, bool);
+
+			template <bool Exact> bin_t		cover_at(bin_t) const;
+			template <bool Exact> bin_t		find_filled_at() const;
+			template <bool Exact> bin_t		find_empty_at(bin_t start) const;
+			template <bool Exact> void		set_at(bin_t);
+			template <bool Exact> void		reset_at(bin_t);
+
+			bool			read_past_end(bin_t, u64 spine, bool padding) const;
+			void			write_past_end(bin_t, u64& spine, bool);
+			bin_t			clip_to_end(bin_t) const;
+			void			update_spine();
+
+			template <bool Exact> bool		is_solid_at(bin_t, bool filled) const;
+			template <bool Exact> bin_t		find_solid_at_layer(s32 layer, u64 from, bool filled) const;
+			template <bool Exact> u64		solid_length_left(u64 offset, u64 floor, bool filled) const;
+			template <bool Exact> u64		solid_length_right(u64 offset, u64 ceiling, u64 need, bool filled) const;
+			template <bool Exact> bin_t		find_run(u64 min_length, u64 from, bool filled) const;
+
 			binmap&			operator = (const binmap&);
 
 			bin_t*	binroot_;
 			u8*	    binmap1_;				// the AND binmap with bit '0' = empty, bit '1' = full, parent = [left-child] & [right-child]
 			u8*	    binmap0_;				// the  OR binmap with bit '0' = empty, bit '1' = full, parent = [left-child] | [right-child]
+
+			// An exact-length binmap only stores the peak sub-trees of @length_ base bins.
+			// Bins that are past the end are not stored, the bins that straddle the end
+			// (one per layer) are kept in the spine, bit N is the bin at layer N.
+			// Bins that are completely past the end read as filled (AND) and empty (OR).
+			u64		length_;
+			u64		spine1_;				// the AND bits of the bins straddling the end
+			u64		spine0_;				// the  OR bits of the bins straddling the end
 		};
 
 		//
@@ -73,15 +122,39 @@ namespace ncore
 		/**
 		* Return the current root of the binmap
 		*/
-		inline bin_t const& cbinmap::root() const
+		inline bin_t const& binmap::root() const
 		{
 			return binroot_!=nullptr ? *binroot_ : bin_t::NONE;
 		}
 
 		/**
-		* Get the value of bin_
+		* Return the number of base bins covered by the binmap
+		*/
+		inline u64 binmap::length() const
+		{
+			return length_;
+		}
+
+		/**
+		* Whether (part of) bin_ is past the end of an exact-length binmap
+		*/
+		inline bool binmap::is_past_end(bin_t _bin) const
+		{
+			return is_exact() && straddles_end(_bin);
+		}
+
+		/**
+		* Whether (part of) bin_ is past the end, only meaningful for an exact-length binmap whose root is at offset 0
+		*/
+		inline bool binmap::straddles_end(bin_t _bin) const
+		{
+			return ((_bin.value() | (_bin.value() + 1)) >> 1) >= length_;
+		}
+
+		/**
+		* Get the value of bin_, the bins past the end of an exact-length binmap are not stored
 		*/
-		inline bool	cbinmap::read_am_at(bin_t _bin) const
+		inline bool	binmap::read_am_at(bin_t _bin) const
 		{
 			ASSERT(binroot_->contains(_bin));
 			u8 const* byte = binmap1_ + (_bin.value() >> 3);
@@ -117,9 +190,9 @@ namespace ncore
 		}
 
 		/**
-		* Get the value of bin_
+		* Get the value of bin_, the bins past the end of an exact-length binmap are not stored
 		*/
-		inline bool	cbinmap::read_om_at(bin_t _bin) const
+		inline bool	binmap::read_om_at(bin_t _bin) const
 		{
 			ASSERT(binroot_->contains(_bin));
 			u8 const* byte = binmap0_ + (_bin.value() >> 3);
@@ -7,6 +7,8 @@
 #endif
 
 #include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_binmap.h"
+#include "cbinmaps/c_merkle_digest.h"
 
 namespace ncore
 {
@@ -18,10 +20,13 @@ namespace ncore
 		{
 			inline			hash_t() : digest_(0), length_(0) {}
 			inline			hash_t(u8* d, u32 l) : digest_(d), length_(l) {}
+			template <u32 N>
+			inline			hash_t(digest<N>& d) : digest_(d.bytes_), length_(N) {}
 			u8*			digest_;
 			u32				length_;
 		};
 
+		bool	is_zero    (hash_t const& _a);
 		bool	are_equal  (hash_t const& _a, hash_t const& _b);
 		bool	are_nequal (hash_t const& _a, hash_t const& _b);
 		s32		compare    (const hash_t& _a, const hash_t& _b);
@@ -30,6 +35,24 @@ namespace ncore
 		//       after the combined signature is computed.
 		typedef void (*combine_f)(hash_t const& _left, hash_t const& _right, hash_t& _out);
 
+		// note: optional multi-lane combiner (e.g. 8-lane SIMD SHA-256), it combines @_count pairs at once where
+		//       @_out[i] = combine(@_left[i], @_right[i]). @_count is at most c_combine_batch_size.
+		//       Like with combine_f, @_out[i] can be one of @_left[i] or @_right[i].
+		typedef void (*combine_batch_f)(hash_t const* _left, hash_t const* _right, hash_t* _out, u32 _count);
+		static const u32 c_combine_batch_size = 16;
+
+		// note: the largest signature length that functions needing scratch signatures on the stack support
+		static const u32 c_max_siglen = 64;
+
+		// note: computes the leaf signature of a chunk of content, the last chunk can be shorter.
+		//       It is called from the jobs of a parallel-for, so it has to be thread-safe.
+		typedef void (*hash_chunk_f)(u8 const* _chunk, u32 _length, hash_t& _out);
+
+		// note: a parallel-for is provided by the user (e.g. dispatching to a work-stealing thread pool), it
+		//       has to call @_job for every index in [0, @_count) and only return when all of them are done.
+		typedef void (*job_f)(void* _ctx, u32 _index);
+		typedef void (*parallel_for_f)(job_f _job, void* _ctx, u32 _count, void* _user);
+
 		/**
 		 * @group		ncore::merkle
 		 * @brief		Merkle-Tree implementation used for content validation
@@ -51,7 +74,9 @@ namespace ncore
 		struct branch_t
 		{
 		public:
+			inline					branch_t() : length_(0), size_(0), array_(0) {}
 			inline					branch_t(hash_t* _array, u32 _length) : length_(_length), size_(0), array_(_array) {}
+			inline					branch_t(hash_t* _array, u32 _length, u32 _size) : length_(_length), size_(_size), array_(_array) {}	// over signatures that are already in place
 
 			inline u32				length() const					{ return length_; }
 			inline u32				size() const					{ return size_; }
@@ -65,23 +90,91 @@ namespace ncore
 			hash_t					*array_;
 		};
 
+		// note: the layout of the signatures in the data
+		//       LAYOUT_INORDER     - indexed by bin value, the children of a node are 2^layer signatures apart
+		//       LAYOUT_LAYER_MAJOR - layer by layer from the base up, the nodes of a layer are consecutive so
+		//                            building a layer and walking up a branch touch far fewer pages
+		enum elayout
+		{
+			LAYOUT_INORDER = 0,
+			LAYOUT_LAYER_MAJOR = 1,
+		};
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Sparse storage of the signatures of a partially known tree
+		 *
+		 * @behavior	An open-addressed table keyed by bin value that only holds the signatures that
+		 *				have been written, the binmap @_present records which bins are held so that a
+		 *				missing signature is found without probing and without a zero signature sentinel.
+		 *				The bin of a signature is recorded as the base bin (0, B.value()), so @_present
+		 *				has to cover tree::trusted_root(@_root).
+		 *				A missing signature reads as a zero signature, which must never be written to.
+		 *				The root signature has a slot of its own outside of the table, it is always held,
+		 *				also after clear().
+		 *
+		 * @required    @_slots is a power of 2, at most 3/4 of them are used
+		 *				@_data is a buffer of size_for(@_siglen, @_slots) bytes
+		 *
+		*/
+		class sparse_t
+		{
+		public:
+									sparse_t(bin_t _root, u32 _siglen, u32 _slots, u8* _data, binmaps::binmap* _present);
+
+			static u64				size_for(u32 _siglen, u32 _slots)	{ return ((u64)_slots * (sizeof(u64) + _siglen)) + (2 * _siglen); }
+
+			void					clear();		// empties the table, the root slot keeps its signature
+
+			u32						size() const					{ return count_ + 1; }
+			u32						remaining() const				{ return max_count_ - count_; }
+
+			bool					has(bin_t _bin) const			{ return present_->is_filled(bin_t(0, _bin.value())); }
+			u8*						find(bin_t _bin) const;		// return: the signature, or the zero signature when it is not held
+			u8*						insert(bin_t _bin);			// return: the signature, nullptr when the table is full
+
+		protected:
+			inline u32				slot_of(bin_t _bin) const		{ return (u32)((_bin.value() * 0x9E3779B97F4A7C15ull) >> shift_); }
+			inline u8*				zero_slot() const				{ return digests_ + ((u64)(mask_ + 1) * siglen_); }
+			inline u8*				root_slot() const				{ return zero_slot() + siglen_; }
+
+			bin_t					root_;
+			u32						siglen_;
+			u32						mask_;
+			s32						shift_;
+			u32						count_;
+			u32						max_count_;
+			u64*					keys_;
+			u8*						digests_;
+			binmaps::binmap*		present_;
+		};
+
 		struct data_t
 		{
 		public:
-			inline					data_t(bin_t _root, u32 _siglen, u8* _data) : root_(_root), siglen_(_siglen), data_(_data) {}
+			inline					data_t(bin_t _root, u32 _siglen, u8* _data, elayout _layout = LAYOUT_INORDER) : root_(_root), siglen_(_siglen), layout_(_layout), data_(_data), sparse_(0) {}
+
+			// the signatures are held by @_sparse, @_header is a buffer of header_size(@_siglen) bytes
+			inline					data_t(bin_t _root, u32 _siglen, u8* _header, sparse_t* _sparse) : root_(_root), siglen_(_siglen), layout_(LAYOUT_INORDER), data_(_header), sparse_(_sparse) {}
 
 			bin_t					get_root() const				{ return root_; }
 			u32						get_siglen() const				{ return siglen_; }
+			elayout					get_layout() const				{ return layout_; }
 			byte*					get_data() const				{ return data_; }
+			sparse_t*				get_sparse() const				{ return sparse_; }
 
-			static u32				size_for(bin_t _root, u32 _siglen);
+			static u64				size_for(bin_t _root, u32 _siglen);
+			static u64				header_size(u32 _siglen)		{ return sizeof(bin_t) + _siglen; }	// the root bin and the work signature
+			static inline u64		index_of(bin_t _root, elayout _layout, bin_t _bin);
 
 		protected:
-			inline					data_t() : root_(bin_t::NONE), siglen_(0), data_(0) {}
+			inline					data_t() : root_(bin_t::NONE), siglen_(0), layout_(LAYOUT_INORDER), data_(0), sparse_(0) {}
 
 			bin_t					root_;
 			u32						siglen_;
+			elayout					layout_;
 			byte*					data_;
+			sparse_t*				sparse_;
 		};
 
 		class ctree
@@ -91,71 +184,290 @@ namespace ncore
 									ctree(data_t& _data);
 
 			s32						read(bin_t _bin, branch_t& _out_branch) const;
+			s32						read(bin_t _bin, branch_t& _out_branch, binmaps::binmap const& _trusted) const;	// the branch stops below the first ancestor that @_trusted holds
 			s32						read(bin_t _bin, hash_t& _out_signature) const;
 
+			bin_t					get_root() const				{ return *root_bin_; }
+			u32						get_siglen() const				{ return root_sig_.length_; }
+			bool					has(bin_t _bin) const;		// the signature of @_bin is known
+
+			// the branch of @_bin without the signatures that the peer knows, a filled bin in @_acked means the
+			// peer has verified it and stored its branch, so it knows every bin with an acknowledged bin below
+			// its parent
+			s32						read_trimmed(bin_t _bin, branch_t& _out_branch, binmaps::binmap const& _acked) const;
+
+			// multi-proof for the range of bins [@_first, @_last] on one layer, the signatures of the
+			// bins in the range and the deduplicated set of siblings needed to resolve the root
+			s32						read_range(bin_t _first, bin_t _last, branch_t& _out_proof) const;	// return: number of signatures, -1 out of range, -2 too small, -3 missing signature
+
 		protected:
 			bin_t*					root_bin_;
 			hash_t					root_sig_;
 			hash_t					work_sig_;
+			elayout					layout_;
+			sparse_t*				sparse_;
 
 			u8*					data_;
 		};
 
 
 
+		// a branch to verify in a batch, @result_ is set to -1 when accepted, -2 when out of range or
+		// malformed, -3 when it does not resolve to the root (or trusted) signature and -4 when the
+		// sparse storage is full.
+		// With a trusted binmap @ancestors_ holds (root.layer() - bin.layer()) signatures, verify() keeps the
+		// signatures it combines there so that storing the branch does not combine them again.
+		struct verify_t
+		{
+			bin_t					bin_;
+			branch_t const*			branch_;
+			s32						result_;
+			u8*						ancestors_;
+		};
+
 		class tree : public ctree
 		{
 		public:
 									tree();
-									tree(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner);
+									tree(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, combine_batch_f _batchcombiner = nullptr);
 
-			s32						write(bin_t _bin, branch_t const& _branch);
+			s32						write(bin_t _bin, branch_t const& _branch);	// return: -1 accepted, -2 out of range or malformed, -3 does not resolve to the root signature, -4 sparse storage is full
+			s32						write_trimmed(bin_t _bin, branch_t const& _branch, binmaps::binmap const& _acked);	// the omitted signatures are taken from this tree
+
+			// verify the branches in parallel and store the accepted ones, return: number of accepted branches
+			u32						write_batch(verify_t* _items, u32 _count, parallel_for_f _parallel_for, void* _user);
+			void					verify(verify_t* _items, u32 _count) const;	// thread-safe while the tree is not written
+			s32						write_range(bin_t _first, bin_t _last, branch_t const& _proof, u8* _scratch = nullptr);	// return: see write(), with a trusted binmap @_scratch has to hold _proof.size() signatures (-2 without)
+
+			// note: a tree can track the signatures it has verified in a binmap, the signature of bin B is
+			//       trusted when the base bin (0, B.value()) of @_trusted is set. The binmap has to cover
+			//       trusted_root(root), the root signature is trusted from the start. With a trusted binmap
+			//       write() stops at the first trusted ancestor and the branch only needs the uncles up to it.
+			static bin_t			trusted_root(bin_t _root)		{ return bin_t::to_root(_root.base_right().value() + 1); }
+			static bin_t			trusted_bin(bin_t _bin)			{ return bin_t(0, _bin.value()); }
+
+			void					set_trusted(binmaps::binmap* _trusted);
+			bool					is_trusted(bin_t _bin) const	{ return trusted_ != nullptr && trusted_->is_filled(trusted_bin(_bin)); }
 
 		protected:
 			s32						write(bin_t _bin, hash_t const& _in_signature);
+			void					store(bin_t _bin, branch_t const& _branch, u8 const* _ancestors);
+			bool					has_room(u32 _count) const		{ return sparse_ == nullptr || sparse_->remaining() >= _count; }
+			static void				verify_job(void* _ctx, u32 _index);
 
 			combine_f				combine_f_;
+			combine_batch_f			combine_batch_f_;
+			binmaps::binmap*		trusted_;
 
-			u32						total_count_sig_;
-			u32						added_count_sig_;
+			u64						total_count_sig_;
+			u64						added_count_sig_;
 
 		public:
 
 			class builder
 			{
 			public:
-										builder(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner);
+										builder(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, combine_batch_f _batchcombiner = nullptr);
 
 				bool					valid() const;
 
 				s32						write(bin_t _bin, hash_t const& _signature);	// return: 1=added, -1 if this was the last signature of a trusted sub-tree that failed to result in the trusted signature
 
 				bool					build();
+				bool					build(parallel_for_f _parallel_for, void* _user);
 				bool					build_and_verify(hash_t const& _root_signature);
 
+				// building while the leaves arrive, a sub-tree can be built as soon as its leaves are written and
+				// once every sub-tree at @_layer is built build_above() builds the layers above it up to the root
+				s32						build(bin_t _subtree);		// return: 0, -2 out of range
+				void					build_above(s32 _layer);
+
+				bin_t					get_root() const				{ return *root_bin_; }
+				u32						get_siglen() const				{ return root_sig_.length_; }
+
+				// incremental updates of an already built tree, the changed leaves are queued in @_queue and
+				// commit() rehashes every ancestor of the queued leaves exactly once.
+				void					set_dirty_queue(u64* _queue, u32 _capacity);
+				s32						update_leaf(bin_t _bin, hash_t const& _signature);	// return: 1=queued, 0=queue was full and has been committed first, -2 out of range
+				u32						commit();											// return: number of internal nodes that were rehashed
+
 			protected:
 				s32						read(bin_t _bin, hash_t& _out_signature) const;
 
+				bool					is_complete() const;
+				void					build_layer(s32 _layer, u64 _offset, u64 _count);
+				void					build_subtree(bin_t _bin);
+				static void				build_subtree_job(void* _ctx, u32 _index);
+				void					rehash(s32 _layer, u64 const* _offsets, u32 _count);
+
 				combine_f				combine_f_;
+				combine_batch_f			combine_batch_f_;
+
+				u64*					dirty_;
+				u32						dirty_capacity_;
+				u32						dirty_count_;
 
-				u32						total_count_sig_;
-				u32						added_count_sig_;
+				u64						total_count_sig_;
+				u64						added_count_sig_;
 
 				bin_t*					root_bin_;
 				hash_t					root_sig_;
 				hash_t					work_sig_;
+				elayout					layout_;
 
 				u8*					data_;
 			};
 		};
 
+		// note: receives the differences of two trees, left to right, as maximal bins of which every leaf differs
+		typedef void (*diff_f)(bin_t _bin, void* _user);
+
+		// note: fetches the signatures of @_count bins of one layer from the remote tree, for example with one
+		//       request/response, the signatures are written one after the other into @_out_signatures.
+		//       return: 0 ok, -1 failed
+		typedef s32 (*fetch_f)(bin_t const* _bins, u32 _count, u8* _out_signatures, void* _user);
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Find the leaves that differ between two trees over the same root
+		 *
+		 * @behavior	Only sub-trees with different signatures are descended into, so k differences in
+		 *				n leaves compare at most 1 + 2k*log2(n) signatures.
+		 *				The remote variant compares layer by layer, every layer is one fetch of the children
+		 *				of the bins that differ, @_bins and @_signatures hold one layer of @_capacity bins
+		 *				(@_signatures is @_capacity times the signature length).
+		 *
+		 * @example		diff(local, remote, on_diff, &ranges);
+		 *
+		*/
+		s64		diff(ctree const& _a, ctree const& _b, diff_f _on_diff, void* _user);	// return: number of compared signatures, -1 different roots
+		s64		diff(ctree const& _local, fetch_f _fetch, void* _fetch_user, diff_f _on_diff, void* _user,
+					 bin_t* _bins, u8* _signatures, u32 _capacity);						// return: number of compared signatures, -1 fetch failed, -2 capacity too small
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Streaming root computation with O(log n) memory
+		 *
+		 * @behavior	Leaf signatures are appended in order, only the peak signatures are kept, which
+		 *				are the roots of the complete sub-trees of the current length (see gen_peaks).
+		 *				The root is identical to the one that tree::builder computes for a tree of
+		 *				bin_t::to_root(length) where the leaves past the length are zero signatures.
+		 *
+		 * @required    @_data is a buffer of size_for(@_siglen) bytes
+		 *
+		*/
+		class streamer
+		{
+		public:
+			static const s32		c_max_peaks = 64;
+
+									streamer(u32 _siglen, u8* _data, combine_f _sigcombiner);
+
+			static u64				size_for(u32 _siglen)			{ return (u64)c_max_peaks * _siglen; }
+
+			void					reset();
+			void					append(hash_t const& _leaf);
+
+			u64						length() const					{ return length_; }
+			s32						peaks(bin_t* _out_bins, hash_t* _out_signatures) const;	// left to right as gen_peaks, @_out_bins needs room for a terminating NONE
+			bool					root(bin_t& _out_root, hash_t& _out_signature) const;		// return: false if empty
+
+		protected:
+			hash_t					at(s32 _index) const			{ return hash_t(data_ + (u64)_index * siglen_, siglen_); }
+
+			combine_f				combine_f_;
+			u32						siglen_;
+			s32						count_;
+			u64						length_;
+			u8*						data_;
+		};
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Append-only Merkle-Tree that grows with its content
+		 *
+		 * @behavior	Leaf i is bin_t(0, i) and the signatures are stored by bin value. The nodes of the
+		 *				complete sub-trees of a length are exactly the bins below 2 * length, so appending
+		 *				only writes past the end and the root (bin_t::to_root(length)) is promoted when the
+		 *				length passes a power of 2 without moving a signature. Appending a leaf combines the
+		 *				sub-trees that it completes, which is one combine per leaf amortized.
+		 *				The peaks are the roots of the complete sub-trees (see gen_peaks), the proof of a bin
+		 *				at a length is its branch up to the peak that covers it, which verifies against the
+		 *				peaks of that length. The root is the one of streamer::root.
+		 *
+		 * @required    @_data is a buffer of size_for(@_siglen, @_capacity) bytes
+		 *
+		 * @example		append_tree tree(32, buffer, capacity, combiner);
+		 *				if (tree.append_leaf(leaf) == -4)
+		 *				    tree.grow(larger, 2 * capacity);	// after copying size_for(32, tree.length()) bytes
+		 *
+		*/
+		class append_tree
+		{
+		public:
+			static const s32		c_max_peaks = 64;
+
+									append_tree(u32 _siglen, u8* _data, u64 _capacity, combine_f _sigcombiner);
+
+			static u64				size_for(u32 _siglen, u64 _capacity)	{ return 2 * _capacity * _siglen; }
+
+			void					reset();
+			void					grow(u8* _data, u64 _capacity);	// @_data already holds the signatures (realloc, mremap or a copy of size_for(length()) bytes)
+
+			s32						append_leaf(hash_t const& _leaf);	// return: 0, -4 full
+
+			u64						length() const					{ return length_; }
+			u64						capacity() const				{ return capacity_; }
+			bool					has(bin_t _bin, u64 _length) const	{ return !_bin.is_none() && !_bin.is_all() && _bin.base_right().layer_offset() < _length; }
+
+			s32						read(bin_t _bin, hash_t& _out_signature) const;	// return: 0, -2 out of range
+			s32						peaks(u64 _length, bin_t* _out_bins, hash_t* _out_signatures) const;	// the peaks at @_length, as gen_peaks, return: count, -1 past the length
+			bool					root(bin_t& _out_root, hash_t& _out_signature) const;	// return: false if empty
+
+			// the proof of @_bin at @_length, return: number of signatures, -1 out of range, -2 too small
+			s32						read(bin_t _bin, u64 _length, branch_t& _out_branch) const;
+
+			// return: -1 accepted, -2 not covered by the peaks or malformed, -3 does not resolve to its peak
+			static s32				verify(bin_t _bin, branch_t const& _proof, bin_t const* _peaks, hash_t const* _peak_signatures, s32 _count, combine_f _sigcombiner);
+
+		protected:
+			hash_t					at(bin_t _bin) const			{ return hash_t(data_ + (_bin.value() * siglen_), siglen_); }
+
+			combine_f				combine_f_;
+			u32						siglen_;
+			u64						length_;
+			u64						capacity_;
+			u8*						data_;
+		};
+
+		/*
+		 The layer-major index of a bin is the number of nodes in the layers below it plus its
+		 offset in its own layer, the layers below layer l hold 2*(B - B/2^l) nodes for B base bins.
+		*/
+		inline u64 data_t::index_of(bin_t _root, elayout _layout, bin_t _bin)
+		{
+			if (_layout == LAYOUT_INORDER)
+				return _bin.value();
+
+			u64 const base = _root.base_length();
+			s32 const layer = _bin.layer();
+			return (2 * (base - (base >> layer))) + (_bin.layer_offset() - (_root.base_offset() >> layer));
+		}
+
 		inline s32 ctree::read(bin_t _bin, hash_t& _out_signature) const
 		{
 			// do we contain this bin ?
 			if (!root_bin_->contains(_bin))
 				return -2;	// out of range
 
-			_out_signature = hash_t(data_ + (_bin.value() * root_sig_.length_), root_sig_.length_);
+			if (sparse_ != nullptr)
+			{
+				_out_signature = hash_t(sparse_->find(_bin), root_sig_.length_);
+				return 0;
+			}
+
+			u64 const signature_offset = data_t::index_of(*root_bin_, layout_, _bin) * root_sig_.length_;
+			_out_signature = hash_t(data_ + signature_offset, root_sig_.length_);
 			return 0;
 		}
 
@@ -165,11 +477,21 @@ namespace ncore
 			if (!root_bin_->contains(_bin))
 				return -2;	// out of range
 
-			u32 const signature_offset = (u32)_bin.value() * root_sig_.length_;
-			hash_t s = hash_t(data_ + signature_offset, root_sig_.length_);
+			u8* dst_sig;
+			if (sparse_ != nullptr)
+			{
+				dst_sig = sparse_->insert(_bin);
+				if (dst_sig == nullptr)
+					return -4;	// full
+			}
+			else
+			{
+				dst_sig = data_ + (data_t::index_of(*root_bin_, layout_, _bin) * root_sig_.length_);
+			}
+			hash_t s = hash_t(dst_sig, root_sig_.length_);
 			u32 const* src = (u32 const*)_in_signature.digest_;
 			u32      * dst = (u32      *)s.digest_;
-			for (s32 i=root_sig_.length_; i>=0; i-=4)
+			for (s32 i=root_sig_.length_; i>0; i-=4)
 				*dst++ = *src++;
 			return 0;
 		}
@@ -180,7 +502,8 @@ namespace ncore
 			if (!root_bin_->contains(_bin))
 				return -2;	// out of range
 
-			_out_signature = hash_t(data_ + (_bin.value() * root_sig_.length_), root_sig_.length_);
+			u64 const signature_offset = data_t::index_of(*root_bin_, layout_, _bin) * root_sig_.length_;
+			_out_signature = hash_t(data_ + signature_offset, root_sig_.length_);
 			return 0;
 		}
 
@@ -0,0 +1,130 @@
+#ifndef __CBINMAPS_MERKLE_DIGEST_H__
+#define __CBINMAPS_MERKLE_DIGEST_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define CBINMAPS_DIGEST_SSE2
+#	include <emmintrin.h>
+#endif
+
+namespace ncore
+{
+	namespace merkle
+	{
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Fixed size digest value (e.g. N = 20, 32 or 64)
+		 *
+		 * @behavior	The bytes are stored inline, 16 byte aligned and padded with zeros to a multiple
+		 *				of 16 bytes. Equality and the zero test process the whole storage without early
+		 *				exit, 16 bytes at a time with SSE2 and 8 bytes at a time otherwise, the padding is
+		 *				always zero so it never influences the result.
+		 *				compare() is lexicographic on the first N bytes, it compares byte-swapped words.
+		 *				Only a non-const digest converts to a hash_t, the view is writable.
+		 *
+		 * @example		A digest can be passed to the runtime API as a hash_t without copying:
+		 *
+		 *                merkle::digest<32> d;
+		 *                tree.read(bin, sig);
+		 *                if (merkle::are_equal(hash_t(d), sig)) ...
+		 *
+		*/
+		template <u32 N>
+		struct alignas(16) digest
+		{
+			static const u32	c_size    = N;
+			static const u32	c_storage = (N + 15) & ~(u32)15;
+
+			inline				digest()							{ clear(); }
+			inline				digest(u8 const* _bytes)			{ clear(); for (u32 i = 0; i < N; ++i) bytes_[i] = _bytes[i]; }
+
+			inline u8*			data()								{ return bytes_; }
+			inline u8 const*	data() const						{ return bytes_; }
+			inline u32			size() const						{ return N; }
+
+			inline void			clear()								{ u64* w = (u64*)bytes_; for (u32 i = 0; i < c_storage / 8; ++i) w[i] = 0; }
+
+			u8					bytes_[c_storage];
+		};
+
+		namespace ndigest
+		{
+			inline u64	load_be64(u8 const* _p)
+			{
+#if defined(__GNUC__) || defined(__clang__)
+				u64 v;
+				__builtin_memcpy(&v, _p, 8);
+#	if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				v = __builtin_bswap64(v);
+#	endif
+				return v;
+#else
+				u64 v = 0;
+				for (s32 i = 0; i < 8; ++i)
+					v = (v << 8) | _p[i];
+				return v;
+#endif
+			}
+		}
+
+		template <u32 N>
+		inline bool are_equal(digest<N> const& _a, digest<N> const& _b)
+		{
+#ifdef CBINMAPS_DIGEST_SSE2
+			__m128i diff = _mm_setzero_si128();
+			for (u32 i = 0; i < digest<N>::c_storage; i += 16)
+				diff = _mm_or_si128(diff, _mm_xor_si128(_mm_load_si128((__m128i const*)(_a.bytes_ + i)), _mm_load_si128((__m128i const*)(_b.bytes_ + i))));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+#else
+			u64 const* a = (u64 const*)_a.bytes_;
+			u64 const* b = (u64 const*)_b.bytes_;
+			u64 diff = 0;
+			for (u32 i = 0; i < digest<N>::c_storage / 8; ++i)
+				diff |= a[i] ^ b[i];
+			return diff == 0;
+#endif
+		}
+
+		template <u32 N>
+		inline bool are_nequal(digest<N> const& _a, digest<N> const& _b)
+		{
+			return !are_equal(_a, _b);
+		}
+
+		template <u32 N>
+		inline bool is_zero(digest<N> const& _a)
+		{
+#ifdef CBINMAPS_DIGEST_SSE2
+			__m128i bits = _mm_setzero_si128();
+			for (u32 i = 0; i < digest<N>::c_storage; i += 16)
+				bits = _mm_or_si128(bits, _mm_load_si128((__m128i const*)(_a.bytes_ + i)));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) == 0xFFFF;
+#else
+			u64 const* a = (u64 const*)_a.bytes_;
+			u64 bits = 0;
+			for (u32 i = 0; i < digest<N>::c_storage / 8; ++i)
+				bits |= a[i];
+			return bits == 0;
+#endif
+		}
+
+		template <u32 N>
+		inline s32 compare(digest<N> const& _a, digest<N> const& _b)
+		{
+			// the padding is zero in both, so comparing whole big-endian words is lexicographic on the N bytes
+			for (u32 i = 0; i < digest<N>::c_storage; i += 8)
+			{
+				u64 const a = ndigest::load_be64(_a.bytes_ + i);
+				u64 const b = ndigest::load_be64(_b.bytes_ + i);
+				if (a != b)
+					return a < b ? -1 : 1;
+			}
+			return 0;
+		}
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_DIGEST_H__
@@ -0,0 +1,71 @@
+#ifndef __CBINMAPS_MERKLE_FILE_H__
+#define __CBINMAPS_MERKLE_FILE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_merkle.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Hash the content of a file into a merkle tree
+		 *
+		 * @behavior	The file is split in chunks, chunk i is leaf bin_t(0, i). The chunks are processed
+		 *				in windows of as many chunks as fit in the buffer (a power of 2), every chunk of a
+		 *				window is one job of the parallel-for that reads the chunk with a positional read
+		 *				and hashes it, so the reads of some jobs overlap the hashing of others.
+		 *				The sub-tree of a window is built by one more job of the next window, so it overlaps
+		 *				the reads and hashes of that window, the layers above the windows are built at the end.
+		 *
+		 * @example		content_hasher hasher(65536, 32, hash_chunk, parallel_for, pool);
+		 *				hasher.open(path);
+		 *				data_t data(hasher.get_root(), 32, buffer);
+		 *				tree::builder builder(data, rootsig, combiner);
+		 *				hasher.hash(builder, window, window_size);
+		 *
+		*/
+		class content_hasher
+		{
+		public:
+									content_hasher(u32 _chunk_size, u32 _siglen, hash_chunk_f _hasher, parallel_for_f _parallel_for, void* _user);
+									~content_hasher();
+
+			s32						open(const char* _path);		// return: 0, -1 failed
+			void					attach(s64 _fd);				// an already open file (fd or HANDLE), it is not closed
+			void					close();
+
+			u64						get_size() const				{ return size_; }
+			u64						get_chunks() const				{ return (size_ + chunk_size_ - 1) / chunk_size_; }
+			bin_t					get_root() const				{ return bin_t::to_root(get_chunks() > 0 ? get_chunks() : 1); }
+
+			// @_buffer holds a window of chunks, it has to hold at least one chunk
+			s32						hash(tree::builder& _builder, u8* _buffer, u64 _buffer_size);	// return: 0, -1 read failed, -2 the tree or the buffer is too small
+
+		protected:
+			static void				hash_job(void* _ctx, u32 _index);
+			static s32				read_at(s64 _file, u64 _offset, u8* _dst, u32 _length);
+			static void				prefetch(s64 _file, u64 _offset, u64 _length);
+
+			u32						chunk_size_;
+			u32						siglen_;
+			hash_chunk_f			hasher_;
+			parallel_for_f			parallel_for_;
+			void*					user_;
+			s64						file_;
+			bool					owned_;
+			u64						size_;
+
+		private:
+									content_hasher(const content_hasher&);
+			content_hasher&			operator = (const content_hasher&);
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_FILE_H__
@@ -0,0 +1,56 @@
+#ifndef __CBINMAPS_MERKLE_HASH_H__
+#define __CBINMAPS_MERKLE_HASH_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+namespace ncore
+{
+	struct sha256_state
+	{
+		u32			h[8];
+		u64			length;
+		u32			buflen;
+		u8			buf[64];
+	};
+
+	void sha256_init	( sha256_state *S );
+	void sha256_update	( sha256_state *S, const u8 *in, u64 inlen );
+	void sha256_final	( sha256_state *S, u8 *out );		// 32 bytes
+
+	struct blake2s_state
+	{
+		u32			h[8], t[2];
+		u32			buflen;
+		u8			buf[64];
+	};
+
+	void blake2s_init	( blake2s_state *S );				// unkeyed, 32 byte digest
+	void blake2s_update	( blake2s_state *S, const u8 *in, u64 inlen );
+	void blake2s_final	( blake2s_state *S, u8 *out );		// 32 bytes
+
+	namespace merkle
+	{
+		// Hash policies for merkle::basic_tree, the parent digest is H(left | right), for a k-ary tree
+		// (see ktree) the parent digest is H(child 0 | child 1 | ... | child k-1). The children can be
+		// shorter than the digest when interior digests are truncated (see truncated_tree).
+		struct sha256_policy
+		{
+			static const u32	c_digest_size = 32;
+			static void			combine(u8 const* _left, u8 const* _right, u8* _out);
+			static void			combine(u8 const* _left, u8 const* _right, u32 _length, u8* _out);
+			static void			combine_n(u8 const* const* _children, u32 _count, u8* _out);
+		};
+
+		struct blake2s_policy
+		{
+			static const u32	c_digest_size = 32;
+			static void			combine(u8 const* _left, u8 const* _right, u8* _out);
+			static void			combine(u8 const* _left, u8 const* _right, u32 _length, u8* _out);
+			static void			combine_n(u8 const* const* _children, u32 _count, u8* _out);
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_HASH_H__
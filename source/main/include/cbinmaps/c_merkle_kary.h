@@ -0,0 +1,87 @@
+#ifndef __CBINMAPS_MERKLE_KARY_H__
+#define __CBINMAPS_MERKLE_KARY_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_merkle.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		// note: combines the signatures of @_count children (the fanout) into the parent signature,
+		//       @_out is never one of @_children.
+		typedef void (*combine_n_f)(hash_t const* _children, u32 _count, hash_t& _out);
+
+		static const u32 c_max_fanout = 16;
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Merkle-Tree with a fanout of 2, 4, 8 or 16
+		 *
+		 * @behavior	A node has fanout children, so there are log2(n)/log2(fanout) levels and one combine
+		 *				per node hashes all children at once. The nodes are bins at the layers that are a
+		 *				multiple of log2(fanout), level L with offset o is bin_t(L * log2(fanout), o), the
+		 *				root is a bin at such a layer (see root_for).
+		 *				The data is [bin_t root][work signature][level 0][level 1]...[root], the nodes of a
+		 *				level are consecutive.
+		 *
+		 *				The proof of a bin is the group of fanout signatures it is part of, followed by the
+		 *				fanout - 1 siblings of every ancestor below the root in offset order, the ancestor
+		 *				itself is left out since it is computed.
+		 *
+		 * @example		Sender :
+		 *                ktree t(data, 8, combiner);
+		 *                t.write(bin_t(0, i), leaf); ...
+		 *                t.build();
+		 *                n = t.read(bin_t(0, i), proof);
+		 *
+		 *              Receiver :
+		 *                ktree t(data, 8, combiner, root_signature);
+		 *                if (t.write(bin_t(0, i), proof) == -1) ...
+		 *
+		*/
+		class ktree
+		{
+		public:
+									ktree(data_t& _data, u32 _fanout, combine_n_f _combiner);
+									ktree(data_t& _data, u32 _fanout, combine_n_f _combiner, hash_t const& _rootsig);	// clears the data
+
+			static bin_t			root_for(u64 _leaves, u32 _fanout);
+			static u64				size_for(bin_t _root, u32 _fanout, u32 _siglen);
+			static u32				proof_length(bin_t _root, u32 _fanout, bin_t _bin);
+
+			u32						get_fanout() const				{ return (u32)1 << shift_; }
+			bin_t					get_root() const				{ return *root_bin_; }
+
+			s32						read(bin_t _bin, hash_t& _out_signature) const;	// return: 0, -2 not a node of this tree
+			s32						read(bin_t _bin, branch_t& _out_proof) const;	// return: number of signatures, -1 out of range, -2 too small, -3 missing signature
+
+			// verify a proof against the root signature, and when valid (write) store it
+			s32						verify(bin_t _bin, branch_t const& _proof) const;	// return: -1 valid, -2 out of range or malformed, -3 does not resolve to the root signature
+			s32						write(bin_t _bin, branch_t const& _proof);			// return: see verify()
+
+			// building, write the leaf signatures and then build the levels above them
+			s32						write(bin_t _bin, hash_t const& _signature);		// return: 0, -2 not a node of this tree
+			hash_t const&			build();
+
+		protected:
+			bool					is_node(bin_t _bin) const;
+			u64						index_of(s32 _level, u64 _offset) const;
+			inline hash_t			at(s32 _level, u64 _offset) const	{ return hash_t(data_ + (index_of(_level, _offset) * root_sig_.length_), root_sig_.length_); }
+			void					resolve(bin_t _bin, branch_t const& _proof, u8* _scratch) const;	// the signature of every ancestor, level by level
+
+			combine_n_f				combine_n_f_;
+			s32						shift_;				// log2(fanout)
+			s32						levels_;			// the root is at this level
+			bin_t*					root_bin_;
+			hash_t					root_sig_;
+			u8*						data_;
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_KARY_H__
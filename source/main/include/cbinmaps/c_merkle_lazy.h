@@ -0,0 +1,108 @@
+#ifndef __CBINMAPS_MERKLE_LAZY_H__
+#define __CBINMAPS_MERKLE_LAZY_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_merkle.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Bounded cache of signatures, least recently used entries are evicted
+		 *
+		 * @behavior	The cache is split in @_stripes independent stripes (a power of 2), each with its own
+		 *				spin lock, LRU list and hash chains, a bin always maps to the same stripe. So readers
+		 *				on different threads mostly take different locks.
+		 *				The hit and miss counters are kept per stripe, reading them while the cache is in
+		 *				use gives an approximation.
+		 *
+		 * @required    @_data is a buffer of size_for(@_siglen, @_stripes, @_entries) bytes, aligned to 8
+		 *
+		*/
+		class lru_cache
+		{
+		public:
+									lru_cache(u32 _siglen, u32 _stripes, u32 _entries, u8* _data);	// @_entries per stripe
+
+			static u64				size_for(u32 _siglen, u32 _stripes, u32 _entries);
+
+			void					clear();
+
+			bool					find(bin_t _bin, u8* _out_signature);		// return: true and the signature copied to @_out_signature, false when not cached
+			void					insert(bin_t _bin, u8 const* _signature);
+
+			u64						hits() const;
+			u64						misses() const;
+			void					reset_counters();
+
+		protected:
+			static inline u64		hash_of(bin_t _bin)				{ u64 const h = (_bin.value() ^ (_bin.value() >> 31)) * 0x9E3779B97F4A7C15ull; return h ^ (h >> 32); }
+			u8*						stripe_of(u32 _stripe) const	{ return data_ + ((u64)_stripe * 64); }
+			u8*						block_of(u32 _stripe) const		{ return data_ + ((u64)stripes_ * 64) + ((u64)_stripe * block_size_); }
+
+			u32						siglen_;
+			u32						stripes_;
+			u32						entries_;
+			u32						buckets_;
+			u64						block_size_;
+			u8*						data_;
+		};
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Read-only Merkle-Tree that only keeps the leaves and the top layers
+		 *
+		 * @behavior	The signatures of the leaves and of the @_top_layers layers below and including the
+		 *				root are stored, any other signature is recomputed from the leaves when it is read.
+		 *				The signatures that a read recomputes go into the (optional) cache, so the uncles
+		 *				that neighbouring branches share are only computed once. Recomputing a signature at layer l
+		 *				costs up to 2^l combines, so the lowest stored layer bounds the cost of a read.
+		 *				Reading is thread-safe, the branches are identical to the ones of ctree::read.
+		 *
+		 * @example		lazy_tree tree(data, 8, combiner, &cache);
+		 *				tree.write(bin_t(0, i), leaf); ...
+		 *				tree.build();
+		 *				tree.read(bin, branch);
+		 *
+		*/
+		class lazy_tree
+		{
+		public:
+									lazy_tree(data_t& _data, s32 _top_layers, combine_f _sigcombiner, lru_cache* _cache);
+
+			static u64				size_for(bin_t _root, u32 _siglen, s32 _top_layers);
+
+			bin_t					get_root() const				{ return *root_bin_; }
+			u32						get_siglen() const				{ return siglen_; }
+
+			// building, write the leaf signatures and then compute the top layers
+			s32						write(bin_t _bin, hash_t const& _signature);	// return: 0, -1 not a leaf of this tree
+			void					build();
+
+			s32						read(bin_t _bin, hash_t& _out_signature) const;	// the signature is copied to @_out_signature, return: 0, -1 out of range
+			s32						read(bin_t _bin, branch_t& _out_branch) const;		// see ctree::read, every signature is known so -3 is never returned
+
+		protected:
+			void					node(bin_t _bin, u8* _out) const;			// stored, cached or computed
+			void					compute(bin_t _bin, u8* _out) const;		// from the leaves
+			u8*						leaf(u64 _offset) const			{ return leaves_ + ((_offset - root_bin_->base_offset()) * siglen_); }
+			u8*						top(bin_t _bin) const;
+
+			combine_f				combine_f_;
+			lru_cache*				cache_;
+			bin_t*					root_bin_;
+			s32						top_layer_;			// the lowest stored layer
+			u32						siglen_;
+			u8*						leaves_;
+			u8*						top_;
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_LAZY_H__
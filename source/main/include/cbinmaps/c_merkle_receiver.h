@@ -0,0 +1,80 @@
+#ifndef __CBINMAPS_MERKLE_RECEIVER_H__
+#define __CBINMAPS_MERKLE_RECEIVER_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_binmap.h"
+#include "cbinmaps/c_merkle.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		// a chunk to accept in a batch, @result_ is set like the return value of receiver::accept_chunk
+		struct chunk_t
+		{
+			bin_t					bin_;
+			u8 const*				bytes_;
+			u32						length_;
+			branch_t const*			proof_;
+			s32						result_;
+			u8						digest_[c_max_siglen];		// the computed leaf signature
+		};
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Accept received chunks, the tree verifies them and the have-map records them
+		 *
+		 * @behavior	A chunk is hashed into its leaf signature, which takes the place of that leaf in
+		 *				the proof (the branch as ctree::read returns it, the peer may leave the leaf zero),
+		 *				so the content and the proof are verified in one pass. Only when the branch resolves
+		 *				to the root (or a trusted) signature the branch is stored and the bin is set in the
+		 *				have-map, which covers the root of the tree.
+		 *				The branches with the computed leaves and the ancestors that verifying them combined are
+		 *				kept in @_scratch, so storing a branch combines nothing. The scratch is 8 byte aligned and
+		 *				holds scratch_size() bytes for the chunks that are verified at once, a burst larger than
+		 *				the scratch is done in rounds.
+		 *
+		 * @example		receiver r(data, root_signature, combiner, hash_chunk, have, scratch, receiver::scratch_size(root, siglen, 64));
+		 *				switch (r.accept_chunk(bin, bytes, length, proof)) ...
+		 *
+		*/
+		class receiver : public tree
+		{
+		public:
+									receiver(data_t& _data, hash_t const& _rootsig, combine_f _sigcombiner, hash_chunk_f _hasher, binmaps::binmap& _have, u8* _scratch, u64 _scratch_size, combine_batch_f _batchcombiner = nullptr);
+
+			// at least 1 chunk, c_combine_batch_size per job to use full batches
+			static u64				scratch_size(bin_t _root, u32 _siglen, u32 _chunks)	{ return (u64)_chunks * ((((u64)_root.layer() + 2) * sizeof(hash_t)) + ((u64)_root.layer() * _siglen)); }
+
+			// return: -1 accepted, 0 already have it, -2 out of range or malformed, -3 the content or the proof
+			//         does not resolve to the root signature, -4 sparse storage is full
+			s32						accept_chunk(bin_t _bin, u8 const* _bytes, u32 _length, branch_t const& _proof);
+
+			// hash and verify the chunks in parallel, then store the accepted ones in order,
+			// return: number of accepted chunks
+			u32						accept_chunks(chunk_t* _chunks, u32 _count, parallel_for_f _parallel_for, void* _user);
+
+			binmaps::binmap const&	have() const					{ return *have_; }
+
+		protected:
+			u32						branch_length() const			{ return (u32)root_bin_->layer() + 2; }
+			hash_t*					branch_at(u32 _slot) const		{ return branches_ + ((u64)_slot * branch_length()); }
+			u8*						ancestors_at(u32 _slot) const	{ return ancestors_ + ((u64)_slot * (u32)root_bin_->layer() * root_sig_.length_); }
+			void					hash_and_verify(chunk_t* _chunks, u32 _count, u32 _slot) const;
+			static void				accept_job(void* _ctx, u32 _index);
+			u32						substitute(chunk_t const& _chunk, hash_t* _array) const;
+
+			hash_chunk_f			hasher_;
+			binmaps::binmap*		have_;
+			hash_t*					branches_;
+			u8*						ancestors_;
+			u32						scratch_chunks_;	// the chunks that fit in the scratch
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_RECEIVER_H__
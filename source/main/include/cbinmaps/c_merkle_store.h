@@ -0,0 +1,99 @@
+#ifndef __CBINMAPS_MERKLE_STORE_H__
+#define __CBINMAPS_MERKLE_STORE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_merkle.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		// note: the hash algorithm that produced the signatures, stored in the header so that a tree is
+		//       never opened with a different combiner
+		static const u32 c_algorithm_none    = 0;
+		static const u32 c_algorithm_sha256  = 1;
+		static const u32 c_algorithm_blake2s = 2;
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		File backed merkle data
+		 *
+		 * @behavior	The file is a page sized header followed by the data of data_t, it is memory mapped so
+		 *				opening is O(1) (only the header is read), pages are loaded when a signature is read
+		 *				and ctree::read serves signatures directly from the page cache.
+		 *				Changes are written back by the OS, flush() forces them to disk.
+		 *
+		 * @example		Create and build once:
+		 *
+		 *                merkle::store_t store;
+		 *                store.create(path, root, 32, merkle::c_algorithm_sha256);
+		 *                merkle::data_t data = store.data();
+		 *                merkle::tree::builder builder(data, rootsig, combiner);
+		 *                ...
+		 *                store.flush();
+		 *
+		 *              Open and serve:
+		 *
+		 *                store.open(path, merkle::c_algorithm_sha256);
+		 *                merkle::data_t data = store.data();
+		 *                merkle::ctree tree(data);
+		 *
+		*/
+		struct store_header_t
+		{
+			static const u32		c_magic   = 0x4C4B524D;	// 'MRKL'
+			static const u32		c_version = 1;
+			static const u32		c_size    = 4096;
+
+			u32						magic_;
+			u32						version_;
+			u32						algorithm_;
+			u32						siglen_;
+			u32						layout_;
+			u32						reserved_;
+			u64						root_;			// bin value of the root
+			u64						data_size_;		// data_t::size_for(root, siglen)
+		};
+
+		class store_t
+		{
+		public:
+									store_t();
+									~store_t();
+
+			// return: 0 = ok, -1 = file or mapping error, -2 = not a store or unsupported version, -3 = different algorithm
+			s32						create(const char* _path, bin_t _root, u32 _siglen, u32 _algorithm, elayout _layout = LAYOUT_INORDER);
+			s32						open(const char* _path, u32 _algorithm, bool _readonly = false);
+			s32						flush();
+			void					close();
+
+			bool					is_open() const					{ return header_ != nullptr; }
+			bin_t					get_root() const				{ return bin_t(header_->root_); }
+			u32						get_siglen() const				{ return header_->siglen_; }
+			u32						get_algorithm() const			{ return header_->algorithm_; }
+
+			data_t					data() const;
+
+		protected:
+			s32						map(u64 _size, bool _readonly);
+
+			store_header_t*			header_;
+			u8*						mapping_;
+			u64						size_;
+			s64						file_;
+#if defined(TARGET_PC)
+			void*					map_handle_;
+#endif
+
+		private:
+									store_t(const store_t&);
+			store_t&				operator = (const store_t&);
+		};
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_STORE_H__
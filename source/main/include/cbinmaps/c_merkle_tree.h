@@ -0,0 +1,459 @@
+#ifndef __CBINMAPS_MERKLE_TREE_H__
+#define __CBINMAPS_MERKLE_TREE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#pragma once
+#endif
+
+#include "ccore/c_debug.h"
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_merkle.h"
+#include "cbinmaps/c_merkle_hash.h"
+
+namespace ncore
+{
+	namespace merkle
+	{
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Merkle-Tree with a compile-time hash policy
+		 *
+		 * @required    @HashPolicy provides:
+		 *				  static const u32 c_digest_size;
+		 *				  static void combine(u8 const* _left, u8 const* _right, u8* _out);
+		 *				where @_out can be one of @_left or @_right (see combine_f).
+		 *
+		 * @behavior	Same bin addressing as tree, [bin_t root, padded to 16][digests indexed by bin value],
+		 *				but the digests are digest<N> values, so copies and compares are a few vector moves
+		 *				and the combiner is called directly instead of through a function pointer.
+		 *				The data has to be 16 byte aligned.
+		 *
+		 * @example		Sender :
+		 *                basic_tree<sha256_policy> t(root, data);
+		 *                t.write_leaf(i, leaf_digest); ...
+		 *                t.build();
+		 *                n = t.read(bin, branch, c_max_branch);
+		 *
+		 *              Receiver :
+		 *                basic_tree<sha256_policy> t(root, data, trusted_root_digest);
+		 *                if (t.write(bin, branch, n) == 0) ...
+		 *
+		*/
+		template <class HashPolicy>
+		class basic_tree
+		{
+		public:
+			static const u32		c_digest_size = HashPolicy::c_digest_size;
+
+			static const u32		c_header_size = 16;
+
+			typedef digest<c_digest_size>	digest_t;
+
+									basic_tree(bin_t _root, byte* _data);
+									basic_tree(bin_t _root, byte* _data, digest_t const& _root_digest);
+
+			static u64				size_for(bin_t _root)				{ return c_header_size + (_root.base_length() * 2 * sizeof(digest_t)); }
+
+			bin_t					root() const						{ return *root_bin_; }
+			digest_t const&			root_digest() const					{ return digests_[root_bin_->value()]; }
+
+			void					clear();
+
+			s32						read(bin_t _bin, digest_t& _out_digest) const;
+			s32						read(bin_t _bin, digest_t* _out_branch, u32 _length) const;	// return: number of digests in the branch, -1 out of range, -2 too small
+			s32						write(bin_t _bin, digest_t const* _branch, u32 _count);		// return: 0 accepted, -2 out of range, -3 does not resolve to the root digest
+
+			s32						write_leaf(u64 _index, digest_t const& _digest);
+			digest_t const&			build();
+
+			static inline void		copy(digest_t& _dst, digest_t const& _src)					{ _dst = _src; }
+			static inline bool		are_equal(digest_t const& _a, digest_t const& _b)			{ return merkle::are_equal(_a, _b); }
+			static inline bool		is_zero(digest_t const& _a)									{ return merkle::is_zero(_a); }
+
+			// adapters so that the runtime API (tree, tree::builder, ktree) can use the same hash policy
+			static void				combine(hash_t const& _left, hash_t const& _right, hash_t& _out);
+			static void				combine_n(hash_t const* _children, u32 _count, hash_t& _out);
+
+		protected:
+			inline digest_t&		at(bin_t _bin)						{ return digests_[_bin.value()]; }
+			inline digest_t const&	at(bin_t _bin) const				{ return digests_[_bin.value()]; }
+
+			bin_t*					root_bin_;
+			digest_t*				digests_;
+		};
+
+		template <class HashPolicy>
+		inline basic_tree<HashPolicy>::basic_tree(bin_t _root, byte* _data)
+			: root_bin_((bin_t*)_data)
+			, digests_((digest_t*)(_data + c_header_size))
+		{
+			ASSERT(((uint_t)_data & 15) == 0);
+			*root_bin_ = _root;
+		}
+
+		template <class HashPolicy>
+		inline basic_tree<HashPolicy>::basic_tree(bin_t _root, byte* _data, digest_t const& _root_digest)
+			: root_bin_((bin_t*)_data)
+			, digests_((digest_t*)(_data + c_header_size))
+		{
+			ASSERT(((uint_t)_data & 15) == 0);
+			*root_bin_ = _root;
+			clear();
+			copy(at(_root), _root_digest);
+		}
+
+		template <class HashPolicy>
+		inline void basic_tree<HashPolicy>::clear()
+		{
+			u64 const count = root_bin_->base_length() * 2;
+			for (u64 i = 0; i < count; ++i)
+				digests_[i].clear();
+		}
+
+		template <class HashPolicy>
+		void basic_tree<HashPolicy>::combine(hash_t const& _left, hash_t const& _right, hash_t& _out)
+		{
+			ASSERT(_left.length_ == c_digest_size && _right.length_ == c_digest_size && _out.length_ == c_digest_size);
+			HashPolicy::combine(_left.digest_, _right.digest_, _out.digest_);
+		}
+
+		template <class HashPolicy>
+		void basic_tree<HashPolicy>::combine_n(hash_t const* _children, u32 _count, hash_t& _out)
+		{
+			ASSERT(_count <= 16 && _out.length_ == c_digest_size);
+			u8 const* children[16];
+			for (u32 i = 0; i < _count; ++i)
+				children[i] = _children[i].digest_;
+			HashPolicy::combine_n(children, _count, _out.digest_);
+		}
+
+		template <class HashPolicy>
+		inline s32 basic_tree<HashPolicy>::read(bin_t _bin, digest_t& _out_digest) const
+		{
+			if (!root_bin_->contains(_bin))
+				return -2;	// out of range
+			copy(_out_digest, at(_bin));
+			return 0;
+		}
+
+		/*
+		 The branch of a bin is the pair of base digests (left, right) followed by the uncles
+		 up to, but not including, the root. This is the format that write() verifies.
+		*/
+		template <class HashPolicy>
+		s32 basic_tree<HashPolicy>::read(bin_t _bin, digest_t* _out_branch, u32 _length) const
+		{
+			if (!root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -1;	// out of range
+
+			u32 const count = (u32)(root_bin_->layer() - _bin.layer()) + 1;
+			if (_length < count)
+				return -2;
+
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+
+			u32 n = 0;
+			copy(_out_branch[n++], at(iter));
+			copy(_out_branch[n++], at(iter.sibling()));
+			iter.to_parent();
+			while (iter != *root_bin_)
+			{
+				copy(_out_branch[n++], at(iter.sibling()));
+				iter.to_parent();
+			}
+			return (s32)n;
+		}
+
+		template <class HashPolicy>
+		s32 basic_tree<HashPolicy>::write(bin_t _bin, digest_t const* _branch, u32 _count)
+		{
+			if (!root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -2;	// out of range
+			if (_count != (u32)(root_bin_->layer() - _bin.layer()) + 1)
+				return -2;
+
+			// first step: determine if this branch resolves to the root digest
+			digest_t work;
+			bin_t iter = _bin;
+			HashPolicy::combine(_branch[0].bytes_, _branch[1].bytes_, work.bytes_);
+			iter.to_parent();
+			for (u32 i = 2; iter != *root_bin_; ++i)
+			{
+				if (iter.is_left())
+					HashPolicy::combine(work.bytes_, _branch[i].bytes_, work.bytes_);
+				else
+					HashPolicy::combine(_branch[i].bytes_, work.bytes_, work.bytes_);
+				iter.to_parent();
+			}
+
+			if (!are_equal(work, root_digest()))
+				return -3;
+
+			// the branch is valid, store the base pair, the uncles and the recomputed path
+			iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+			copy(at(iter), _branch[0]);
+			copy(at(iter.sibling()), _branch[1]);
+			HashPolicy::combine(_branch[0].bytes_, _branch[1].bytes_, at(iter.parent()).bytes_);
+			iter.to_parent();
+			for (u32 i = 2; iter != *root_bin_; ++i)
+			{
+				copy(at(iter.sibling()), _branch[i]);
+				bin_t const parent = iter.parent();
+				HashPolicy::combine(at(parent.left()).bytes_, at(parent.right()).bytes_, at(parent).bytes_);
+				iter = parent;
+			}
+			return 0;
+		}
+
+		template <class HashPolicy>
+		inline s32 basic_tree<HashPolicy>::write_leaf(u64 _index, digest_t const& _digest)
+		{
+			if (_index >= root_bin_->base_length())
+				return -2;	// out of range
+			copy(at(bin_t(0, _index)), _digest);
+			return 0;
+		}
+
+		/*
+		 Build the digests from the base level up until the root, returns the root digest
+		*/
+		template <class HashPolicy>
+		typename basic_tree<HashPolicy>::digest_t const& basic_tree<HashPolicy>::build()
+		{
+			// in-order numbering: the children of value v at layer l are v - 2^(l-1) and v + 2^(l-1)
+			s32 const top = root_bin_->layer();
+			for (s32 layer = 1; layer <= top; ++layer)
+			{
+				u64 const half  = (u64)1 << (layer - 1);
+				u64 const step  = (u64)1 << (layer + 1);
+				u64 const count = root_bin_->base_length() >> layer;
+				u64 v = ((u64)1 << layer) - 1;
+				for (u64 o = 0; o < count; ++o, v += step)
+					HashPolicy::combine(digests_[v - half].bytes_, digests_[v + half].bytes_, digests_[v].bytes_);
+			}
+			return root_digest();
+		}
+
+		typedef basic_tree<sha256_policy>	sha256_tree;
+		typedef basic_tree<blake2s_policy>	blake2s_tree;
+
+		/**
+		 * @group		ncore::merkle
+		 * @brief		Merkle-Tree with truncated interior digests
+		 *
+		 * @behavior	The leaves and the root keep the full digest, the interior nodes only keep the first
+		 *				@InteriorSize bytes of their digest. A parent is H(left | right) over the stored
+		 *				children, so above the leaves the combiner hashes two short digests (2 x 16 bytes fit
+		 *				in one SHA-256 block instead of two).
+		 *				The data is [bin_t root, padded to 16][root digest][leaf digests][interior digests],
+		 *				the interior digest of bin value v (an odd value) is at index v / 2. The data has to
+		 *				be 16 byte aligned.
+		 *
+		 *				Proofs are for leaves only, the full digests of the leaf pair followed by the truncated
+		 *				uncles up to, but not including, the root.
+		 *
+		 * @note		A truncated interior digest has @InteriorSize * 4 bits of collision resistance instead
+		 *				of c_digest_size * 4, the root and the leaves are unchanged.
+		 *
+		*/
+		template <class HashPolicy, u32 InteriorSize>
+		class truncated_tree
+		{
+		public:
+			static const u32		c_digest_size   = HashPolicy::c_digest_size;
+			static const u32		c_interior_size = InteriorSize;
+
+			static const u32		c_header_size = 16;
+
+			typedef digest<c_digest_size>	digest_t;
+			typedef digest<c_interior_size>	interior_t;
+
+									truncated_tree(bin_t _root, byte* _data);
+									truncated_tree(bin_t _root, byte* _data, digest_t const& _root_digest);
+
+			static u64				size_for(bin_t _root)				{ return c_header_size + sizeof(digest_t) + (_root.base_length() * (sizeof(digest_t) + sizeof(interior_t))); }
+
+			bin_t					root() const						{ return *root_bin_; }
+			digest_t const&			root_digest() const					{ return *root_digest_; }
+			digest_t const&			leaf(u64 _index) const				{ return leaves_[_index - root_bin_->base_offset()]; }
+
+			void					clear();
+
+			s32						read(bin_t _bin, digest_t* _out_pair, interior_t* _out_uncles, u32 _length) const;	// return: number of uncles, -1 out of range, -2 too small
+			s32						write(bin_t _bin, digest_t const* _pair, interior_t const* _uncles, u32 _count);	// return: 0 accepted, -2 out of range, -3 does not resolve to the root digest
+
+			s32						write_leaf(u64 _index, digest_t const& _digest);
+			digest_t const&			build();
+
+		protected:
+			// the leaves and the interiors are stored relative to the root, like build() walks them
+			inline interior_t&		interior(bin_t _bin)				{ return interiors_[(_bin.value() - root_bin_->base_left().value()) >> 1]; }
+			inline interior_t const&	interior(bin_t _bin) const		{ return interiors_[(_bin.value() - root_bin_->base_left().value()) >> 1]; }
+
+			static inline void		truncate(interior_t& _dst, digest_t const& _src)	{ for (u32 i = 0; i < c_interior_size; ++i) _dst.bytes_[i] = _src.bytes_[i]; }
+
+			bin_t*					root_bin_;
+			digest_t*				root_digest_;
+			digest_t*				leaves_;
+			interior_t*				interiors_;
+		};
+
+		template <class HashPolicy, u32 InteriorSize>
+		inline truncated_tree<HashPolicy, InteriorSize>::truncated_tree(bin_t _root, byte* _data)
+			: root_bin_((bin_t*)_data)
+			, root_digest_((digest_t*)(_data + c_header_size))
+			, leaves_((digest_t*)(_data + c_header_size + sizeof(digest_t)))
+			, interiors_((interior_t*)(_data + c_header_size + sizeof(digest_t) + (_root.base_length() * sizeof(digest_t))))
+		{
+			ASSERT(((uint_t)_data & 15) == 0 && c_interior_size <= c_digest_size);
+			*root_bin_ = _root;
+		}
+
+		template <class HashPolicy, u32 InteriorSize>
+		inline truncated_tree<HashPolicy, InteriorSize>::truncated_tree(bin_t _root, byte* _data, digest_t const& _root_digest)
+			: root_bin_((bin_t*)_data)
+			, root_digest_((digest_t*)(_data + c_header_size))
+			, leaves_((digest_t*)(_data + c_header_size + sizeof(digest_t)))
+			, interiors_((interior_t*)(_data + c_header_size + sizeof(digest_t) + (_root.base_length() * sizeof(digest_t))))
+		{
+			ASSERT(((uint_t)_data & 15) == 0 && c_interior_size <= c_digest_size);
+			*root_bin_ = _root;
+			clear();
+			*root_digest_ = _root_digest;
+		}
+
+		template <class HashPolicy, u32 InteriorSize>
+		inline void truncated_tree<HashPolicy, InteriorSize>::clear()
+		{
+			u64 const count = root_bin_->base_length();
+			root_digest_->clear();
+			for (u64 i = 0; i < count; ++i)
+			{
+				leaves_[i].clear();
+				interiors_[i].clear();
+			}
+		}
+
+		template <class HashPolicy, u32 InteriorSize>
+		s32 truncated_tree<HashPolicy, InteriorSize>::read(bin_t _bin, digest_t* _out_pair, interior_t* _out_uncles, u32 _length) const
+		{
+			if (!_bin.is_base() || !root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -1;	// out of range
+
+			u32 const count = (u32)root_bin_->layer() - 1;
+			if (_length < count)
+				return -2;
+
+			bin_t iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+			_out_pair[0] = leaf(iter.layer_offset());
+			_out_pair[1] = leaf(iter.sibling().layer_offset());
+
+			u32 n = 0;
+			for (iter.to_parent(); iter != *root_bin_; iter.to_parent())
+				_out_uncles[n++] = interior(iter.sibling());
+			return (s32)n;
+		}
+
+		template <class HashPolicy, u32 InteriorSize>
+		s32 truncated_tree<HashPolicy, InteriorSize>::write(bin_t _bin, digest_t const* _pair, interior_t const* _uncles, u32 _count)
+		{
+			if (!_bin.is_base() || !root_bin_->contains(_bin) || _bin == *root_bin_)
+				return -2;	// out of range
+			if (_count != (u32)root_bin_->layer() - 1)
+				return -2;
+
+			// first step: determine if this branch resolves to the root digest
+			digest_t full;
+			interior_t work;
+			bin_t iter = _bin.parent();
+			HashPolicy::combine(_pair[0].bytes_, _pair[1].bytes_, c_digest_size, full.bytes_);
+			for (u32 i = 0; iter != *root_bin_; ++i)
+			{
+				truncate(work, full);
+				if (iter.is_left())
+					HashPolicy::combine(work.bytes_, _uncles[i].bytes_, c_interior_size, full.bytes_);
+				else
+					HashPolicy::combine(_uncles[i].bytes_, work.bytes_, c_interior_size, full.bytes_);
+				iter.to_parent();
+			}
+
+			if (!merkle::are_equal(full, root_digest()))
+				return -3;
+
+			// the branch is valid, store the leaf pair, the uncles and the recomputed path
+			iter = _bin;
+			if (iter.is_right())
+				iter.to_sibling();
+			leaves_[iter.layer_offset() - root_bin_->base_offset()] = _pair[0];
+			leaves_[iter.sibling().layer_offset() - root_bin_->base_offset()] = _pair[1];
+			iter.to_parent();
+			for (u32 i = 0; iter != *root_bin_; ++i)
+			{
+				interior(iter.sibling()) = _uncles[i];
+				bin_t const l = iter.left();
+				if (iter.layer() == 1)
+					HashPolicy::combine(leaf(l.layer_offset()).bytes_, leaf(l.layer_offset() + 1).bytes_, c_digest_size, full.bytes_);
+				else
+					HashPolicy::combine(interior(l).bytes_, interior(iter.right()).bytes_, c_interior_size, full.bytes_);
+				truncate(interior(iter), full);
+				iter.to_parent();
+			}
+			return 0;
+		}
+
+		template <class HashPolicy, u32 InteriorSize>
+		inline s32 truncated_tree<HashPolicy, InteriorSize>::write_leaf(u64 _index, digest_t const& _digest)
+		{
+			if (!root_bin_->contains(bin_t(0, _index)))
+				return -2;	// out of range
+			leaves_[_index - root_bin_->base_offset()] = _digest;
+			return 0;
+		}
+
+		/*
+		 Build the layers from the leaves up until the root, only the root digest is kept in full
+		*/
+		template <class HashPolicy, u32 InteriorSize>
+		typename truncated_tree<HashPolicy, InteriorSize>::digest_t const& truncated_tree<HashPolicy, InteriorSize>::build()
+		{
+			s32 const top = root_bin_->layer();
+			if (top == 0)
+			{
+				*root_digest_ = leaves_[0];
+				return root_digest();
+			}
+
+			// in-order numbering: the children of value v at layer l are v - 2^(l-1) and v + 2^(l-1)
+			digest_t full;
+			for (s32 layer = 1; layer <= top; ++layer)
+			{
+				u64 const half  = (u64)1 << (layer - 1);
+				u64 const step  = (u64)1 << (layer + 1);
+				u64 const count = root_bin_->base_length() >> layer;
+				u64 v = ((u64)1 << layer) - 1;
+				for (u64 o = 0; o < count; ++o, v += step)
+				{
+					if (layer == 1)
+						HashPolicy::combine(leaves_[2 * o].bytes_, leaves_[(2 * o) + 1].bytes_, c_digest_size, full.bytes_);
+					else
+						HashPolicy::combine(interiors_[(v - half) >> 1].bytes_, interiors_[(v + half) >> 1].bytes_, c_interior_size, full.bytes_);
+					if (layer == top)
+						*root_digest_ = full;
+					else
+						truncate(interiors_[v >> 1], full);
+				}
+			}
+			return root_digest();
+		}
+
+		typedef truncated_tree<sha256_policy, 16>	sha256_truncated_tree;
+	}
+}
+
+#endif	// __CBINMAPS_MERKLE_TREE_H__
@@ -0,0 +1,270 @@
+#ifndef __CBINMAP_STATIC_BINMAP_H__
+#define __CBINMAP_STATIC_BINMAP_H__
+#include "ccore/c_target.h"
+
+#include "ccore/c_debug.h"
+#include "cbinmaps/c_bin.h"
+#include "cbinmaps/c_binmap.h"
+
+namespace ncore
+{
+	namespace binmaps
+	{
+		namespace nstatic
+		{
+			constexpr u64	pow2_ceil(u64 v, u64 p = 1)		{ return p >= v ? p : pow2_ceil(v, p << 1); }
+			constexpr s32	log2(u64 v)						{ return v <= 1 ? 0 : 1 + log2(v >> 1); }
+		}
+
+		//
+		// static binmap class
+		//
+		// A binmap for a compile-time number of base bins with the data stored inline, so it
+		// can live on the stack. The root, layer count and offsets of the AND/OR binmaps are
+		// compile-time constants and every function accesses the data directly, without a root
+		// pointer or contains checks. It is not a binmap, but the data has the same layout, so
+		// view() gives a regular binmap over the same bits for copy() and find_complement().
+		// When N is not a power of 2 the base bins past N read as filled to is_filled() and as
+		// empty to is_empty(), like an exact-length binmap, and are never found. The view needs
+		// a power of 2, the exact-length binmap does not keep the bins straddling the end inline.
+		//
+		template <u64 N>
+		class static_binmap
+		{
+		public:
+			static const u64			c_base_length = nstatic::pow2_ceil(N);
+			static const s32			c_root_layer  = nstatic::log2(c_base_length);
+			static const bin_t::uint_t	c_root_value  = c_base_length - 1;
+			static const bin_t::uint_t	c_last_value  = (c_base_length * 2) - 2;
+			static const u32			c_binmap_size = (u32)(((c_base_length * 2) + 7) / 8);
+			static const u32			c_am_offset   = sizeof(bin_t);
+			static const u32			c_om_offset   = sizeof(bin_t) + c_binmap_size;
+			static const u32			c_data_words  = (c_om_offset + c_binmap_size + 7) / 8;
+			static const bool			c_is_exact    = c_base_length != N;
+
+							static_binmap()							{ *(bin_t*)data_ = bin_t(c_root_value); clear(); }
+
+			bin_t			root() const							{ return bin_t(c_root_value); }
+			u64				length() const							{ return N; }
+
+			bool			read_am_at(bin_t bin) const				{ return read_at(c_am_offset, value_of(bin)); }
+			bool			read_om_at(bin_t bin) const				{ return read_at(c_om_offset, value_of(bin)); }
+
+			bool			is_empty() const						{ return !read_at(c_om_offset, c_root_value); }
+			bool			is_filled() const						{ return read_at(c_am_offset, c_root_value); }
+
+			bool			is_empty(const bin_t& bin) const		{ return !read_at(c_om_offset, value_of(bin)); }
+			bool			is_filled(const bin_t& bin) const		{ return read_at(c_am_offset, value_of(bin)); }
+
+			bin_t			find_empty() const;
+			bin_t			find_filled() const;
+
+			void			clear()									{ write_all(0); write_tail(bin_t(c_root_value)); }
+			void			fill()									{ write_all(~(u64)0); write_tail(bin_t(c_root_value)); }
+
+			void			set(const bin_t& bin);
+			void			reset(const bin_t& bin);
+
+			binmap			view()									{ static_assert(!c_is_exact, "the view needs a power of 2"); return binmap(bin_t(c_root_value), (byte*)data_); }
+			binmap const	view() const							{ static_assert(!c_is_exact, "the view needs a power of 2"); return binmap(bin_t(c_root_value), (byte*)data_); }	// the root is already in place, it is rewritten with the same value
+
+		protected:
+			static bin_t::uint_t	value_of(const bin_t& bin);
+			static bool		is_past_end(const bin_t& bin)			{ return c_is_exact && bin.base_offset() >= N; }
+			static bool		straddles_end(const bin_t& bin)			{ return c_is_exact && bin.base_offset() < N && (bin.base_offset() + bin.base_length()) > N; }
+
+			bool			read_at(u32 offset, bin_t::uint_t v) const;
+			void			write_at(u32 offset, bin_t::uint_t v, bool value);
+			void			write_range(u32 offset, bin_t::uint_t l, bin_t::uint_t r, bool value);
+			void			write_all(u64 value);
+			void			write_tail(const bin_t& bin);
+
+			u64				data_[c_data_words];
+		};
+
+		template <u64 N>
+		inline bin_t::uint_t static_binmap<N>::value_of(const bin_t& bin)
+		{
+			if (bin.is_all())
+				return c_root_value;
+			ASSERT(bin.value() <= c_last_value);
+			return bin.value();
+		}
+
+		template <u64 N>
+		inline bool static_binmap<N>::read_at(u32 offset, bin_t::uint_t v) const
+		{
+			u8 const* byte = (u8 const*)data_ + offset + (v >> 3);
+			return (*byte & (0x80 >> (v & 0x07))) != 0;
+		}
+
+		template <u64 N>
+		inline void static_binmap<N>::write_at(u32 offset, bin_t::uint_t v, bool value)
+		{
+			u8*      byte = (u8*)data_ + offset + (v >> 3);
+			u8 const bit  = 0x80 >> (v & 0x07);
+			if (value) *byte = *byte | bit;
+			else *byte = *byte & ~bit;
+		}
+
+		/**
+		* Write the bits of the in-order range [l, r], which is the sub-tree of a bin
+		*/
+		template <u64 N>
+		inline void static_binmap<N>::write_range(u32 offset, bin_t::uint_t l, bin_t::uint_t r, bool value)
+		{
+			u8* lb = (u8*)data_ + offset + (l >> 3);
+			u8* rb = (u8*)data_ + offset + (r >> 3);
+			u8 const lm = 0xFF >> (l & 0x07);
+			u8 const rm = (u8)(0xFF80 >> (r & 0x07));
+			u8 const fv = value ? 0xFF : 0x00;
+			if (lb == rb)
+			{
+				u8 const m = lm & rm;
+				*lb = (*lb & ~m) | (fv & m);
+			}
+			else
+			{
+				*lb = (*lb & ~lm) | (fv & lm);
+				for (++lb; lb < rb; ++lb)
+					*lb = fv;
+				*rb = (*rb & ~rm) | (fv & rm);
+			}
+		}
+
+		template <u64 N>
+		inline void static_binmap<N>::write_all(u64 value)
+		{
+			// the first word is the root bin
+			for (u32 i = 1; i < c_data_words; ++i)
+				data_[i] = value;
+		}
+
+		/**
+		* Rewrite the bins of the sub-tree of @bin past the end as filled in the AND map and as empty
+		* in the OR map, and recompute the bins straddling the end from their children
+		*/
+		template <u64 N>
+		inline void static_binmap<N>::write_tail(const bin_t& bin)
+		{
+			if (is_past_end(bin))
+			{
+				write_range(c_am_offset, bin.base_left().value(), bin.base_right().value(), true);
+				write_range(c_om_offset, bin.base_left().value(), bin.base_right().value(), false);
+			}
+			else if (straddles_end(bin))
+			{
+				write_tail(bin.left());
+				write_tail(bin.right());
+				write_at(c_am_offset, bin.value(), read_at(c_am_offset, bin.left().value()) && read_at(c_am_offset, bin.right().value()));
+				write_at(c_om_offset, bin.value(), read_at(c_om_offset, bin.left().value()) || read_at(c_om_offset, bin.right().value()));
+			}
+		}
+
+		/**
+		* Find first empty bin
+		*/
+		template <u64 N>
+		inline bin_t static_binmap<N>::find_empty() const
+		{
+			if (read_at(c_am_offset, c_root_value))
+				return bin_t::NONE;
+
+			// a bin straddling the end is empty when its base bins before the end are, keep descending
+			bin_t i(c_root_value);
+			for (s32 layer = c_root_layer; layer > 0; --layer)
+			{
+				if (!read_at(c_om_offset, i.value()) && !straddles_end(i))
+					return i;
+				bin_t c = i.left();
+				if (read_at(c_am_offset, c.value()))
+					c = i.right();
+				i = c;
+			}
+			return i;
+		}
+
+		/**
+		* Find first filled bin
+		*/
+		template <u64 N>
+		inline bin_t static_binmap<N>::find_filled() const
+		{
+			if (!read_at(c_om_offset, c_root_value))
+				return bin_t::NONE;
+
+			bin_t i(c_root_value);
+			for (s32 layer = c_root_layer; layer > 0; --layer)
+			{
+				bin_t c = i.left();
+				if (!read_at(c_om_offset, c.value()))
+					c = i.right();
+				i = c;
+			}
+			return i;
+		}
+
+		/**
+		* Sets bins
+		*/
+		template <u64 N>
+		inline void static_binmap<N>::set(const bin_t& bin)
+		{
+			if (bin.is_none())
+				return;
+
+			bin_t::uint_t const v = value_of(bin);
+			bin_t ib(v);
+			if (is_past_end(ib))
+				return;
+			write_range(c_om_offset, ib.base_left().value(), ib.base_right().value(), true);
+			write_range(c_am_offset, ib.base_left().value(), ib.base_right().value(), true);
+			write_tail(ib);
+
+			// the trip count is a constant, the layers below the bin are skipped
+			bool iv = true;
+			for (s32 layer = 0; layer < c_root_layer; ++layer)
+			{
+				if (layer < ib.layer())
+					continue;
+				iv = iv && read_at(c_am_offset, ib.sibling().value());
+				ib.to_parent();
+				write_at(c_om_offset, ib.value(), true);
+				write_at(c_am_offset, ib.value(), iv);
+			}
+		}
+
+		/**
+		* Resets bins
+		*/
+		template <u64 N>
+		inline void static_binmap<N>::reset(const bin_t& bin)
+		{
+			if (bin.is_none())
+				return;
+
+			bin_t::uint_t const v = value_of(bin);
+			bin_t ib(v);
+			if (is_past_end(ib))
+				return;
+			write_range(c_om_offset, ib.base_left().value(), ib.base_right().value(), false);
+			write_range(c_am_offset, ib.base_left().value(), ib.base_right().value(), false);
+			write_tail(ib);
+
+			// the trip count is a constant, the layers below the bin are skipped
+			bool iv = false;
+			for (s32 layer = 0; layer < c_root_layer; ++layer)
+			{
+				if (layer < ib.layer())
+					continue;
+				iv = iv || read_at(c_om_offset, ib.sibling().value());
+				ib.to_parent();
+				write_at(c_om_offset, ib.value(), iv);
+				write_at(c_am_offset, ib.value(), false);
+			}
+		}
+	}
+
+} // namespace end
+
+#endif // __CBINMAP_STATIC_BINMAP_H__
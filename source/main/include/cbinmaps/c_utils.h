@@ -16,7 +16,7 @@ namespace ncore
 		while (length)
 		{
 			if (length & 1)
-				peaks[pp++] = bin_t((u32)((2 * length - 1) << layer) - 1);
+				peaks[pp++] = bin_t(layer, length - 1);
 			length >>= 1;
 			layer++;
 		}
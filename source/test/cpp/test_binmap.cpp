@@ -9,6 +9,10 @@
 #include "cunittest/cunittest.h"
 #include "cbinmaps/test_allocator.h"
 
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+#    include <sys/mman.h>
+#endif
+
 using namespace ncore;
 
 UNITTEST_SUITE_BEGIN(binmap)
@@ -359,6 +363,202 @@ UNITTEST_SUITE_BEGIN(binmap)
             b.set(bin_t(1, 2));
             CHECK_TRUE(b.is_filled(bin_t(2, 1)));
         }
+
+        UNITTEST_TEST(FindEmptyRun)
+        {
+            clear_data();
+
+            u32 const       n = 64;
+            binmaps::binmap b(binmaps::user_data(bin_t::to_root(n), data1));
+
+            b.set(bin_t(0, 2));
+            b.set(bin_t(1, 3));
+            b.set(bin_t(2, 3));
+            b.set(bin_t(0, 20));
+
+            // empty: [0,2) [3,6) [8,12) [16,20) [21,64)
+            CHECK_EQUAL(bin_t(0, 0).value(), b.find_empty_run(1, 0).value());
+            CHECK_EQUAL(bin_t(0, 0).value(), b.find_empty_run(2, 0).value());
+            CHECK_EQUAL(bin_t(0, 3).value(), b.find_empty_run(3, 0).value());
+            CHECK_EQUAL(bin_t(0, 8).value(), b.find_empty_run(4, 0).value());
+            CHECK_EQUAL(bin_t(0, 21).value(), b.find_empty_run(5, 0).value());
+            CHECK_EQUAL(bin_t(0, 21).value(), b.find_empty_run(43, 0).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(44, 0).value());
+
+            CHECK_EQUAL(bin_t(0, 4).value(), b.find_empty_run(2, 4).value());
+            CHECK_EQUAL(bin_t(0, 9).value(), b.find_empty_run(3, 9).value());
+            CHECK_EQUAL(bin_t(0, 16).value(), b.find_empty_run(3, 10).value());
+            CHECK_EQUAL(bin_t(0, 63).value(), b.find_empty_run(1, 63).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(2, 63).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(1, 64).value());
+
+            b.fill();
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(1, 0).value());
+            b.clear();
+            CHECK_EQUAL(bin_t(0, 0).value(), b.find_empty_run(64, 0).value());
+        }
+
+        UNITTEST_TEST(FindFilledRun)
+        {
+            clear_data();
+
+            u32 const       n = 1024;
+            binmaps::binmap b(binmaps::user_data(bin_t::to_root(n), data1));
+
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_filled_run(1, 0).value());
+
+            // filled: [5,9) [100,356) [511,513)
+            for (u32 i = 5; i < 9; ++i)
+                b.set(bin_t(0, i));
+            for (u32 i = 100; i < 356; ++i)
+                b.set(bin_t(0, i));
+            b.set(bin_t(0, 511));
+            b.set(bin_t(0, 512));
+
+            CHECK_EQUAL(bin_t(0, 5).value(), b.find_filled_run(4, 0).value());
+            CHECK_EQUAL(bin_t(0, 100).value(), b.find_filled_run(5, 0).value());
+            CHECK_EQUAL(bin_t(0, 100).value(), b.find_filled_run(256, 0).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_filled_run(257, 0).value());
+            CHECK_EQUAL(bin_t(0, 511).value(), b.find_filled_run(2, 356).value());
+            CHECK_EQUAL(bin_t(0, 300).value(), b.find_filled_run(56, 300).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_filled_run(3, 356).value());
+        }
+
+        UNITTEST_TEST(Grow)
+        {
+            clear_data();
+
+            binmaps::binmap b(binmaps::user_data(bin_t::to_root(4), data1));
+
+            b.fill();
+            CHECK_TRUE(b.is_filled());
+
+            // grow in-place, the new part is empty
+            b.grow(bin_t::to_root(8), data1);
+            CHECK_EQUAL(bin_t(3, 0).value(), b.root().value());
+            CHECK_TRUE(b.is_filled(bin_t(2, 0)));
+            CHECK_TRUE(b.is_empty(bin_t(2, 1)));
+            CHECK_FALSE(b.is_filled());
+            CHECK_FALSE(b.is_empty());
+            CHECK_EQUAL(bin_t(2, 1).value(), b.find_empty().value());
+
+            b.reset(bin_t(0, 1));
+            b.set(bin_t(0, 5));
+
+            // grow several layers at once into another buffer
+            b.grow(bin_t::to_root(1024), data2);
+            CHECK_EQUAL(bin_t(10, 0).value(), b.root().value());
+            CHECK_TRUE(b.is_filled(bin_t(0, 0)));
+            CHECK_TRUE(b.is_empty(bin_t(0, 1)));
+            CHECK_TRUE(b.is_filled(bin_t(1, 1)));
+            CHECK_TRUE(b.is_filled(bin_t(0, 5)));
+            CHECK_TRUE(b.is_empty(bin_t(9, 1)));
+            CHECK_EQUAL(bin_t(0, 1).value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 6).value(), b.find_empty_run(2, 0).value());
+
+            b.set(bin_t(0, 1));
+            b.set(bin_t(0, 4));
+            b.set(bin_t(1, 3));
+            b.set(bin_t(3, 1));
+            b.set(bin_t(4, 1));
+            b.set(bin_t(5, 1));
+            b.set(bin_t(6, 1));
+            b.set(bin_t(7, 1));
+            b.set(bin_t(8, 1));
+            b.set(bin_t(9, 1));
+            CHECK_TRUE(b.is_filled());
+        }
+
+        UNITTEST_TEST(ExactLength)
+        {
+            clear_data();
+
+            // 21 base bins, peaks (4,0) (2,4) (0,20)
+            u64 const       n = 21;
+            binmaps::binmap b(n, data1);
+
+            CHECK_EQUAL(bin_t(5, 0).value(), b.root().value());
+            CHECK_EQUAL(n, b.length());
+            CHECK_TRUE(binmaps::binmap::size_for(n) < binmaps::binmap::size_for(bin_t::to_root(n)));
+
+            bin_t peaks[65];
+            CHECK_EQUAL(3, b.peaks(peaks));
+            CHECK_EQUAL(bin_t(4, 0).value(), peaks[0].value());
+            CHECK_EQUAL(bin_t(2, 4).value(), peaks[1].value());
+            CHECK_EQUAL(bin_t(0, 20).value(), peaks[2].value());
+
+            CHECK_TRUE(b.is_empty());
+            b.set(bin_t(4, 0));
+            b.set(bin_t(1, 8));
+            b.set(bin_t(0, 19));
+            CHECK_FALSE(b.is_filled(bin_t::ALL));
+            CHECK_EQUAL(bin_t(0, 18).value(), b.find_empty().value());
+
+            b.set(bin_t(0, 18));
+            CHECK_EQUAL(bin_t(0, 20).value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 20).value(), b.find_empty(bin_t(0, 17)).value());
+
+            // the last base bin fills the map, bins past the end are never empty
+            b.set(bin_t(0, 20));
+            CHECK_TRUE(b.is_filled());
+            CHECK_TRUE(b.is_filled(bin_t::ALL));
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(1, 0).value());
+            CHECK_EQUAL(bin_t(2, 4).value(), b.cover(bin_t(0, 16)).value());
+
+            // setting a bin that straddles the end only sets the part in front of the end
+            b.reset(bin_t(3, 2));
+            CHECK_TRUE(b.is_empty(bin_t(2, 4)));
+            CHECK_EQUAL(bin_t(2, 4).value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 16).value(), b.find_empty_run(5, 0).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run(6, 0).value());
+            b.set(bin_t(3, 2));
+            CHECK_TRUE(b.is_filled());
+
+            b.reset(bin_t(0, 3));
+            CHECK_EQUAL(bin_t(0, 3).value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 3).value(), b.find_empty_run(1, 0).value());
+            b.clear();
+            CHECK_TRUE(b.is_empty(bin_t::ALL));
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_filled().value());
+        }
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+        UNITTEST_TEST(Huge)
+        {
+            // 2^35 base bins need 16 GiB, use sparse memory so only the touched pages are committed
+            bin_t const root = bin_t::to_root((u64)1 << 35);
+            u64 const   size = binmaps::data::size_for(root);
+            CHECK_TRUE(size > ((u64)1 << 32));
+
+            void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            CHECK_TRUE(mem != MAP_FAILED);
+            if (mem == MAP_FAILED)
+                return;
+
+            binmaps::binmap b(binmaps::user_data(root, (u8*)mem));
+            CHECK_TRUE(b.is_empty());
+            CHECK_TRUE(b.total_size() > ((u64)1 << 32));
+
+            bin_t const last(0, ((u64)1 << 35) - 1);
+            b.set(last);
+            CHECK_TRUE(b.is_filled(last));
+            CHECK_FALSE(b.is_empty());
+            CHECK_EQUAL(last.value(), b.find_filled().value());
+            CHECK_EQUAL(bin_t(34, 0).value(), b.find_empty().value());
+
+            b.set(bin_t(10, 0));
+            CHECK_EQUAL(bin_t(10, 1).value(), b.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 1024).value(), b.find_empty_run((u64)1 << 34, 0).value());
+            CHECK_EQUAL(bin_t::NONE.value(), b.find_empty_run((u64)1 << 35, 0).value());
+
+            b.reset(last);
+            CHECK_TRUE(b.is_empty(bin_t(34, 1)));
+            CHECK_FALSE(b.is_filled());
+
+            munmap(mem, size);
+        }
+#endif
     }
 }
 UNITTEST_SUITE_END
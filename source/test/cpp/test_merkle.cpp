@@ -4,7 +4,2048 @@
 #include "cbase/c_memory.h"
 #include "cbase/c_integer.h"
 #include "cbinmaps/merkle.h"
+#include "cbinmaps/merkle_tree.h"
+#include "cbinmaps/merkle_kary.h"
+#include "cbinmaps/merkle_store.h"
+#include "cbinmaps/merkle_file.h"
+#include "cbinmaps/merkle_receiver.h"
+#include "cbinmaps/merkle_lazy.h"
+#include "cbinmaps/utils.h"
 #include "cunittest/cunittest.h"
 
 using namespace ncore;
 
+#include "cbinmaps/test_allocator.h"
+
+#include <atomic>
+#include <thread>
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+#    include <stdio.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+namespace
+{
+    // simple (non-cryptographic) combiner, good enough to test the tree mechanics
+    void test_combine(merkle::hash_t const& _left, merkle::hash_t const& _right, merkle::hash_t& _out)
+    {
+        u8 h[64];
+        for (u32 i = 0; i < _out.length_; ++i)
+            h[i] = (u8)((_left.digest_[i] * 31) + _right.digest_[(i + 1) % _right.length_] + 7);
+        for (u32 i = 0; i < _out.length_; ++i)
+            _out.digest_[i] = h[i];
+    }
+
+    std::atomic<u32> g_combine_calls(0);
+
+    void test_combine_counted(merkle::hash_t const& _left, merkle::hash_t const& _right, merkle::hash_t& _out)
+    {
+        g_combine_calls += 1;
+        test_combine(_left, _right, _out);
+    }
+
+    std::atomic<u32> g_batch_calls(0);
+    std::atomic<u32> g_batch_pairs(0);
+
+    void test_combine_batch(merkle::hash_t const* _left, merkle::hash_t const* _right, merkle::hash_t* _out, u32 _count)
+    {
+        g_batch_calls += 1;
+        g_batch_pairs += _count;
+        for (u32 i = 0; i < _count; ++i)
+            test_combine(_left[i], _right[i], _out[i]);
+    }
+
+    struct diff_result_t
+    {
+        bin_t bins_[16];
+        u32   count_;
+    };
+
+    void test_on_diff(bin_t _bin, void* _user)
+    {
+        diff_result_t* result = (diff_result_t*)_user;
+        if (result->count_ < 16)
+            result->bins_[result->count_] = _bin;
+        result->count_ += 1;
+    }
+
+    struct remote_t
+    {
+        merkle::ctree const* tree_;
+        u32                  fetches_;
+    };
+
+    s32 test_fetch(bin_t const* _bins, u32 _count, u8* _out_signatures, void* _user)
+    {
+        remote_t* remote = (remote_t*)_user;
+        remote->fetches_ += 1;
+        u32 const siglen = remote->tree_->get_siglen();
+        for (u32 i = 0; i < _count; ++i)
+        {
+            merkle::hash_t sig;
+            remote->tree_->read(_bins[i], sig);
+            nmem::memcpy(_out_signatures + (i * siglen), sig.digest_, siglen);
+        }
+        return 0;
+    }
+
+    void test_leaf(u64 _index, merkle::hash_t& _out)
+    {
+        for (u32 i = 0; i < _out.length_; ++i)
+            _out.digest_[i] = (u8)((_index >> ((i & 7) * 8)) + i);
+    }
+
+    // a simple parallel-for, the workers pull (steal) indices from a shared counter
+    void test_parallel_for(merkle::job_f _job, void* _ctx, u32 _count, void* _user)
+    {
+        (void)_user;
+        std::atomic<u32> next(0);
+        auto             worker = [&]() {
+            for (u32 i = next++; i < _count; i = next++)
+                _job(_ctx, i);
+        };
+        std::thread threads[4];
+        for (auto& t : threads)
+            t = std::thread(worker);
+        for (auto& t : threads)
+            t.join();
+    }
+
+    void test_hash_chunk(u8 const* _chunk, u32 _length, merkle::hash_t& _out)
+    {
+        sha256_state S;
+        sha256_init(&S);
+        sha256_update(&S, _chunk, _length);
+        sha256_final(&S, _out.digest_);
+    }
+
+    s32 from_hex(char _c) { return (_c >= 'a') ? (_c - 'a' + 10) : (_c - '0'); }
+
+    bool equal_hex(u8 const* _digest, const char* _hex)
+    {
+        for (u32 i = 0; _hex[i * 2] != 0; ++i)
+        {
+            if (_digest[i] != (u8)((from_hex(_hex[i * 2]) << 4) | from_hex(_hex[i * 2 + 1])))
+                return false;
+        }
+        return true;
+    }
+} // namespace
+
+UNITTEST_SUITE_BEGIN(merkle)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(BuildParallel)
+        {
+            u32 const   siglen = 32;
+            bin_t const root   = bin_t::to_root(1 << 20);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::data_t        d2(root, siglen, data2);
+            merkle::tree::builder serial(d1, root_sig, test_combine);
+            merkle::tree::builder parallel(d2, root_sig, test_combine);
+
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                serial.write(bin_t(0, i), leaf);
+                parallel.write(bin_t(0, i), leaf);
+            }
+
+            CHECK_TRUE(serial.build());
+            CHECK_TRUE(parallel.build(test_parallel_for, nullptr));
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            // without a parallel-for the sub-trees are built in turn
+            CHECK_TRUE(parallel.build(nullptr, nullptr));
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(BuildIncomplete)
+        {
+            u32 const   siglen = 32;
+            bin_t const root   = bin_t(10, 1); // not at offset 0
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+
+            merkle::data_t        d1(root, siglen, data1, merkle::LAYOUT_LAYER_MAJOR);
+            merkle::data_t        d2(root, siglen, data2, merkle::LAYOUT_LAYER_MAJOR);
+            merkle::tree::builder serial(d1, root_sig, test_combine);
+            merkle::tree::builder parallel(d2, root_sig, test_combine);
+
+            // a leaf without a signature fails both builds
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = root.base_offset(); i < root.base_offset() + root.base_length(); ++i)
+            {
+                if (i == root.base_offset() + 77)
+                    continue;
+                test_leaf(i, leaf);
+                serial.write(bin_t(0, i), leaf);
+                parallel.write(bin_t(0, i), leaf);
+            }
+            CHECK_FALSE(serial.build());
+            CHECK_FALSE(parallel.build(test_parallel_for, nullptr));
+
+            test_leaf(root.base_offset() + 77, leaf);
+            serial.write(bin_t(0, root.base_offset() + 77), leaf);
+            parallel.write(bin_t(0, root.base_offset() + 77), leaf);
+            CHECK_TRUE(serial.build());
+            CHECK_TRUE(parallel.build(test_parallel_for, nullptr));
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(BuildBatched)
+        {
+            u32 const   siglen = 32;
+            bin_t const root   = bin_t::to_root(1 << 12);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::data_t        d2(root, siglen, data2);
+            merkle::tree::builder scalar(d1, root_sig, test_combine);
+            merkle::tree::builder batched(d2, root_sig, test_combine, test_combine_batch);
+
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                scalar.write(bin_t(0, i), leaf);
+                batched.write(bin_t(0, i), leaf);
+            }
+
+            g_batch_calls = 0;
+            g_batch_pairs = 0;
+            CHECK_TRUE(scalar.build());
+            CHECK_TRUE(batched.build());
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            // every internal node is combined once, in full batches except for the small top layers
+            CHECK_EQUAL((1 << 12) - 1, g_batch_pairs.load());
+            CHECK_EQUAL(((1 << 12) - 16) / 16 + 4, g_batch_calls.load());
+
+            nmem::memclr(data2, size);
+            merkle::tree::builder parallel(d2, root_sig, test_combine, test_combine_batch);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                parallel.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(parallel.build(test_parallel_for, nullptr));
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(UpdateLeaf)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 12;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::data_t        d2(root, siglen, data2);
+            merkle::tree::builder incremental(d1, root_sig, test_combine_counted);
+            merkle::tree::builder full(d2, root_sig, test_combine, test_combine_batch);
+
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                incremental.write(bin_t(0, i), leaf);
+                full.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(incremental.build());
+
+            // 6 changed leaves, 2 of them are siblings, 3 of them share the left half
+            u64 const changed[] = {4000, 7, 6, 1500, 4095, 0};
+            u32 const k         = sizeof(changed) / sizeof(changed[0]);
+            u64       queue[8];
+            incremental.set_dirty_queue(queue, 8);
+            for (u32 i = 0; i < k; ++i)
+            {
+                test_leaf(changed[i] * 3 + 1, leaf);
+                CHECK_EQUAL(1, incremental.update_leaf(bin_t(0, changed[i]), leaf));
+                full.write(bin_t(0, changed[i]), leaf);
+            }
+            CHECK_EQUAL(-2, incremental.update_leaf(bin_t(1, 0), leaf));
+
+            g_combine_calls = 0;
+            u32 const rehashed = incremental.commit();
+            CHECK_EQUAL(rehashed, g_combine_calls.load());
+            CHECK_TRUE(rehashed < k * layers);
+            CHECK_EQUAL(0u, incremental.commit());
+
+            CHECK_TRUE(full.build());
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            // without a queue every update rehashes its path directly
+            incremental.set_dirty_queue(nullptr, 0);
+            g_combine_calls = 0;
+            test_leaf(12345, leaf);
+            CHECK_EQUAL(1, incremental.update_leaf(bin_t(0, 99), leaf));
+            CHECK_EQUAL((u32)layers, g_combine_calls.load());
+            full.write(bin_t(0, 99), leaf);
+            CHECK_TRUE(full.build());
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            // a full queue is committed before the next leaf is queued
+            incremental.set_dirty_queue(queue, 2);
+            for (u32 i = 0; i < 3; ++i)
+            {
+                test_leaf(i * 11, leaf);
+                CHECK_EQUAL(i < 2 ? 1 : 0, incremental.update_leaf(bin_t(0, 100 + i * 50), leaf));
+                full.write(bin_t(0, 100 + i * 50), leaf);
+            }
+            incremental.commit();
+            CHECK_TRUE(full.build());
+            CHECK_EQUAL(0, nmem::memcmp(data1, data2, size));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(Streamer)
+        {
+            u32 const siglen = 32;
+            u8*       sdata  = (u8*)Allocator->allocate((u32)merkle::streamer::size_for(siglen), sizeof(void*));
+            CHECK_TRUE(merkle::streamer::size_for(siglen) < 4096);
+
+            merkle::streamer stream(siglen, sdata, test_combine);
+            bin_t            root;
+            u8               root_digest[siglen];
+            merkle::hash_t   root_sig(root_digest, siglen);
+            CHECK_FALSE(stream.root(root, root_sig));
+
+            u64 const lengths[] = {1, 2, 5, 1000, 1024, 1025};
+            for (u32 l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+            {
+                u64 const   n     = lengths[l];
+                bin_t const troot = bin_t::to_root(n);
+                u32 const   size  = (u32)merkle::data_t::size_for(troot, siglen);
+                u8*         data  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+                u8             zero_digest[siglen] = {0};
+                merkle::hash_t zero_sig(zero_digest, siglen);
+                merkle::data_t        d(troot, siglen, data);
+                merkle::tree::builder builder(d, zero_sig, test_combine);
+
+                stream.reset();
+                u8             leaf_digest[siglen];
+                merkle::hash_t leaf(leaf_digest, siglen);
+                for (u64 i = 0; i < n; ++i)
+                {
+                    test_leaf(i, leaf);
+                    builder.write(bin_t(0, i), leaf);
+                    stream.append(leaf);
+                }
+                CHECK_EQUAL(0, builder.build(troot)); // the leaves past the length stay zero
+                CHECK_EQUAL(n, stream.length());
+
+                // the root equals the one of the tree where the leaves past the length are zero
+                CHECK_TRUE(stream.root(root, root_sig));
+                CHECK_TRUE(root == troot);
+                merkle::ctree  tree(d);
+                merkle::hash_t sig;
+                tree.read(troot, sig);
+                CHECK_TRUE(merkle::are_equal(sig, root_sig));
+
+                // the peaks are the roots of the complete sub-trees
+                bin_t          peaks[merkle::streamer::c_max_peaks + 1];
+                bin_t          expected[merkle::streamer::c_max_peaks + 1];
+                merkle::hash_t peak_sigs[merkle::streamer::c_max_peaks];
+                s32 const      count = stream.peaks(peaks, peak_sigs);
+                CHECK_EQUAL(gen_peaks(n, expected), count);
+                for (s32 i = 0; i < count; ++i)
+                {
+                    CHECK_TRUE(peaks[i] == expected[i]);
+                    tree.read(peaks[i], sig);
+                    CHECK_TRUE(merkle::are_equal(sig, peak_sigs[i]));
+                }
+
+                Allocator->deallocate(data);
+            }
+
+            Allocator->deallocate(sdata);
+        }
+
+        UNITTEST_TEST(AppendTree)
+        {
+            u32 const siglen   = 32;
+            u64       capacity = 8;
+            u8*       data     = (u8*)Allocator->allocate((u32)merkle::append_tree::size_for(siglen, capacity), sizeof(void*));
+            u8*       sdata    = (u8*)Allocator->allocate((u32)merkle::streamer::size_for(siglen), sizeof(void*));
+
+            merkle::append_tree tree(siglen, data, capacity, test_combine_counted);
+            merkle::streamer    stream(siglen, sdata, test_combine);
+            bin_t               root;
+            u8                  d1[siglen], d2[siglen];
+            merkle::hash_t      r1(d1, siglen), r2(d2, siglen);
+            CHECK_FALSE(tree.root(root, r1));
+
+            // the buffer grows by doubling, the root follows the length
+            u32            combines = 0;
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < 1000; ++i)
+            {
+                test_leaf(i, leaf);
+                u32 const calls = g_combine_calls;
+                if (tree.append_leaf(leaf) == -4)
+                {
+                    u8* larger = (u8*)Allocator->allocate((u32)merkle::append_tree::size_for(siglen, capacity * 2), sizeof(void*));
+                    nmem::memcpy(larger, data, (u32)merkle::append_tree::size_for(siglen, tree.length()));
+                    Allocator->deallocate(data);
+                    data = larger;
+                    capacity *= 2;
+                    tree.grow(data, capacity);
+                    CHECK_EQUAL(0, tree.append_leaf(leaf));
+                }
+                combines += g_combine_calls - calls;
+                stream.append(leaf);
+
+                if ((i & (i + 1)) == 0 || i == 699)
+                {
+                    CHECK_TRUE(tree.root(root, r1));
+                    CHECK_TRUE(root == bin_t::to_root(i + 1));
+                    stream.root(root, r2);
+                    CHECK_TRUE(merkle::are_equal(r1, r2));
+                }
+            }
+            CHECK_EQUAL(1000, tree.length());
+            CHECK_EQUAL(1000 - 6, combines); // one per completed sub-tree, 6 peaks remain
+
+            // the peaks are those of the streamer
+            bin_t          peaks[merkle::append_tree::c_max_peaks + 1];
+            bin_t          speaks[merkle::streamer::c_max_peaks + 1];
+            merkle::hash_t sigs[merkle::append_tree::c_max_peaks];
+            merkle::hash_t ssigs[merkle::streamer::c_max_peaks];
+            s32 const      count = tree.peaks(1000, peaks, sigs);
+            CHECK_EQUAL(stream.peaks(speaks, ssigs), count);
+            for (s32 i = 0; i < count; ++i)
+            {
+                CHECK_TRUE(peaks[i] == speaks[i]);
+                CHECK_TRUE(merkle::are_equal(sigs[i], ssigs[i]));
+            }
+            CHECK_EQUAL(-1, tree.peaks(1001, peaks, sigs));
+
+            // a proof at an earlier length verifies against the peaks of that length
+            u8             digests[16][siglen];
+            merkle::hash_t hashes[16];
+            for (s32 i = 0; i < 16; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+            merkle::branch_t proof(hashes, 16);
+            bin_t const      bin(0, 600);
+            s32 const        n = tree.read(bin, 700, proof);
+            CHECK_EQUAL(7 + 2, n);
+            CHECK_EQUAL(-1, tree.read(bin_t(0, 700), 700, proof));
+            CHECK_EQUAL(-1, tree.read(bin, 1001, proof));
+
+            bin_t          peaks700[merkle::append_tree::c_max_peaks + 1];
+            merkle::hash_t sigs700[merkle::append_tree::c_max_peaks];
+            s32 const      count700 = tree.peaks(700, peaks700, sigs700);
+            CHECK_EQUAL(-1, merkle::append_tree::verify(bin, proof, peaks700, sigs700, count700, test_combine));
+            CHECK_EQUAL(-2, merkle::append_tree::verify(bin, proof, peaks, sigs, count, test_combine));
+            hashes[3].digest_[5] ^= 1;
+            CHECK_EQUAL(-3, merkle::append_tree::verify(bin, proof, peaks700, sigs700, count700, test_combine));
+            hashes[3].digest_[5] ^= 1;
+
+            // a peak is its own proof
+            merkle::branch_t peak_proof(hashes, 16);
+            CHECK_EQUAL(1, tree.read(peaks700[0], 700, peak_proof));
+            CHECK_EQUAL(-1, merkle::append_tree::verify(peaks700[0], peak_proof, peaks700, sigs700, count700, test_combine));
+
+            // at a power of 2 the proof is the branch of the full tree
+            bin_t const troot = bin_t::to_root(512);
+            u8*         full  = (u8*)Allocator->allocate((u32)merkle::data_t::size_for(troot, siglen), sizeof(void*));
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d(troot, siglen, full);
+            merkle::tree::builder builder(d, zero_sig, test_combine);
+            for (u64 i = 0; i < 512; ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+            merkle::ctree    ctree(d);
+            u8               digests2[16][siglen];
+            merkle::hash_t   hashes2[16];
+            for (s32 i = 0; i < 16; ++i)
+                hashes2[i] = merkle::hash_t(digests2[i], siglen);
+            merkle::branch_t b1(hashes, 16), b2(hashes2, 16);
+            CHECK_EQUAL(ctree.read(bin_t(0, 77), b2), tree.read(bin_t(0, 77), 512, b1));
+            for (u32 i = 0; i < b2.size(); ++i)
+                CHECK_TRUE(merkle::are_equal(*b1[i], *b2[i]));
+
+            Allocator->deallocate(full);
+            Allocator->deallocate(sdata);
+            Allocator->deallocate(data);
+        }
+
+        UNITTEST_TEST(LayerMajor)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 14;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data3  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            // every bin maps to a unique index inside the data
+            for (s32 l = 0; l <= layers; ++l)
+            {
+                u64 const n = root.base_length() >> l;
+                CHECK_EQUAL(2 * (root.base_length() - n), merkle::data_t::index_of(root, merkle::LAYOUT_LAYER_MAJOR, bin_t(l, 0)));
+                CHECK_EQUAL(2 * (root.base_length() - n) + n - 1, merkle::data_t::index_of(root, merkle::LAYOUT_LAYER_MAJOR, bin_t(l, n - 1)));
+            }
+            CHECK_EQUAL(root.base_length() * 2 - 2, merkle::data_t::index_of(root, merkle::LAYOUT_LAYER_MAJOR, root));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::data_t        d2(root, siglen, data2, merkle::LAYOUT_LAYER_MAJOR);
+            merkle::tree::builder inorder(d1, root_sig, test_combine);
+            merkle::tree::builder layered(d2, root_sig, test_combine);
+
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                inorder.write(bin_t(0, i), leaf);
+                layered.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(inorder.build());
+            CHECK_TRUE(layered.build(test_parallel_for, nullptr));
+
+            // same signatures, different places
+            merkle::ctree  t1(d1);
+            merkle::ctree  t2(d2);
+            merkle::hash_t s1, s2;
+            for (u64 v = 0; v < root.base_length() * 2 - 1; v += 7)
+            {
+                t1.read(bin_t(v), s1);
+                t2.read(bin_t(v), s2);
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+            }
+            CHECK_TRUE(nmem::memcmp(data1, data2, size) != 0);
+
+            // a branch read from one layout verifies on a tree with the other layout
+            t1.read(root, s1);
+            merkle::data_t d3(root, siglen, data3, merkle::LAYOUT_LAYER_MAJOR);
+            nmem::memclr(data3, size);
+            merkle::tree   receiver(d3, s1, test_combine);
+
+            u8             digests[layers + 2][siglen];
+            merkle::hash_t hashes[layers + 2];
+            for (s32 i = 0; i < layers + 2; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            bin_t const      bin(0, 12345);
+            merkle::branch_t branch(hashes, layers + 2);
+            bin_t            iter = bin.is_left() ? bin : bin.sibling();
+            t1.read(iter, s1);
+            branch.push(s1);
+            t1.read(iter.sibling(), s1);
+            branch.push(s1);
+            for (iter.to_parent(); iter != root; iter.to_parent())
+            {
+                t1.read(iter.sibling(), s1);
+                branch.push(s1);
+            }
+            CHECK_EQUAL(-1, receiver.write(bin, branch));
+            t1.read(bin, s1);
+            receiver.read(bin, s2);
+            CHECK_TRUE(merkle::are_equal(s1, s2));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+            Allocator->deallocate(data3);
+        }
+
+        UNITTEST_TEST(MultiProof)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 10;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, test_combine);
+
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            merkle::ctree  sender(d1);
+            u8             root_digest[siglen];
+            merkle::hash_t root_sig(root_digest, siglen);
+            merkle::hash_t sig;
+            sender.read(root, sig);
+            nmem::memcpy(root_digest, sig.digest_, siglen);
+
+            u8             digests[256][siglen];
+            merkle::hash_t hashes[256];
+            for (s32 i = 0; i < 256; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            // 64 adjacent leaves need the leaves and at most 2 siblings per layer
+            bin_t const      first(0, 100);
+            bin_t const      last(0, 163);
+            merkle::branch_t proof(hashes, 256);
+            s32 const        n = sender.read_range(first, last, proof);
+            CHECK_TRUE(n >= 64 && n <= 64 + 2 * layers);
+            merkle::branch_t small(hashes, 64);
+            CHECK_EQUAL(-2, sender.read_range(first, last, small));
+            CHECK_EQUAL(-1, sender.read_range(last, first, small));
+
+            nmem::memclr(data2, size);
+            merkle::data_t d2(root, siglen, data2);
+            merkle::tree   receiver(d2, root_sig, test_combine_counted);
+
+            // every ancestor of the range is combined exactly once
+            u32 ancestors = 0;
+            for (s32 l = 1; l <= layers; ++l)
+                ancestors += (u32)((last.layer_offset() >> l) - (first.layer_offset() >> l) + 1);
+            g_combine_calls = 0;
+            CHECK_EQUAL(-1, receiver.write_range(first, last, proof));
+            CHECK_EQUAL(ancestors, g_combine_calls.load());
+
+            merkle::hash_t s1, s2;
+            for (u64 i = first.layer_offset(); i <= last.layer_offset(); ++i)
+            {
+                sender.read(bin_t(0, i), s1);
+                receiver.read(bin_t(0, i), s2);
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+            }
+            // the siblings are stored, the bins they cover are not
+            sender.read(bin_t(2, 24), s1);
+            receiver.read(bin_t(2, 24), s2);
+            CHECK_TRUE(merkle::are_equal(s1, s2));
+            receiver.read(bin_t(0, 99), s2);
+            CHECK_TRUE(merkle::are_equal(zero_sig, s2));
+
+            // corrupted or incomplete proofs are rejected
+            digests[n / 2][3] ^= 1;
+            CHECK_EQUAL(-3, receiver.write_range(first, last, proof));
+            merkle::branch_t partial(hashes, n - 1);
+            for (s32 i = 0; i < n - 1; ++i)
+                partial.push(*proof[i]);
+            CHECK_EQUAL(-2, receiver.write_range(first, last, partial));
+
+            // a range at a higher layer and the single bin range
+            merkle::branch_t proof2(hashes, 256);
+            s32 const        n2 = sender.read_range(bin_t(3, 5), bin_t(3, 9), proof2);
+            CHECK_TRUE(n2 > 0);
+            CHECK_EQUAL(-1, receiver.write_range(bin_t(3, 5), bin_t(3, 9), proof2));
+            merkle::branch_t proof3(hashes, 256);
+            CHECK_EQUAL(layers + 1, sender.read_range(bin_t(0, 7), bin_t(0, 7), proof3));
+            CHECK_EQUAL(-1, receiver.write_range(bin_t(0, 7), bin_t(0, 7), proof3));
+            merkle::branch_t proof4(hashes, 256);
+            CHECK_EQUAL(1, sender.read_range(root, root, proof4));
+            CHECK_EQUAL(-1, receiver.write_range(root, root, proof4));
+
+            // a single branch read from the tree verifies
+            merkle::branch_t branch(hashes, layers + 2);
+            merkle::branch_t short_branch(hashes, layers + 1);
+            CHECK_EQUAL(-2, sender.read(bin_t(0, 5), short_branch));
+            CHECK_EQUAL(layers + 2, sender.read(bin_t(0, 5), branch));
+            CHECK_EQUAL(-1, receiver.write(bin_t(0, 5), branch));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(TrustedEarlyExit)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 10;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, test_combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            merkle::ctree  sender(d1);
+            merkle::hash_t sig;
+            sender.read(root, sig);
+
+            bin_t const     troot = merkle::tree::trusted_root(root);
+            u32 const       tsize = (u32)binmaps::binmap::size_for(troot);
+            u8*             tdata = (u8*)Allocator->allocate(tsize, sizeof(void*));
+            binmaps::binmap trusted(troot, tdata);
+            trusted.clear();
+
+            nmem::memclr(data2, size);
+            merkle::data_t d2(root, siglen, data2);
+            merkle::tree   receiver(d2, sig, test_combine_counted);
+            receiver.set_trusted(&trusted);
+            CHECK_TRUE(receiver.is_trusted(root));
+            CHECK_FALSE(receiver.is_trusted(bin_t(0, 0)));
+
+            u8             digests[layers + 2][siglen];
+            merkle::hash_t hashes[layers + 2];
+            for (s32 i = 0; i < layers + 2; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            // the first branch is the full one, then the branches stop at uncles of the earlier ones
+            g_combine_calls = 0;
+            u32 signatures  = 0;
+            for (u64 i = 0; i < root.base_length(); i += 2)
+            {
+                merkle::branch_t branch(hashes, layers + 2);
+                s32 const        n = sender.read(bin_t(0, i), branch, trusted);
+                CHECK_TRUE(n >= 2);
+                signatures += n;
+                CHECK_EQUAL(-1, receiver.write(bin_t(0, i), branch));
+            }
+            // pair k needs an uncle for each trailing zero bit of k, the parent of an odd pair is trusted
+            u32 expected = (u32)root.base_length() + layers - 1;
+            for (u64 k = 1; k < root.base_length() / 2; ++k)
+                for (u64 b = k; (b & 1) == 0; b >>= 1)
+                    expected += 1;
+            CHECK_EQUAL(expected, signatures);
+            // only verifying combines, a branch of n signatures takes n - 1 and storing it none
+            CHECK_EQUAL(signatures - (u32)root.base_length() / 2, g_combine_calls.load());
+
+            merkle::hash_t s1, s2;
+            for (u64 v = 0; v < root.base_length() * 2 - 1; ++v)
+            {
+                sender.read(bin_t(v), s1);
+                receiver.read(bin_t(v), s2);
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+                CHECK_TRUE(receiver.is_trusted(bin_t(v)));
+            }
+
+            // a corrupted pair is rejected against the trusted parent
+            merkle::branch_t branch(hashes, layers + 2);
+            CHECK_EQUAL(2, sender.read(bin_t(0, 6), branch, trusted));
+            digests[0][0] ^= 1;
+            g_combine_calls = 0;
+            CHECK_EQUAL(-3, receiver.write(bin_t(0, 6), branch));
+            CHECK_EQUAL(1u, g_combine_calls.load());
+
+            // a range proof makes the range and its ancestors trusted as well
+            trusted.clear();
+            nmem::memclr(data2, size);
+            merkle::tree ranged(d2, sig, test_combine_counted);
+            ranged.set_trusted(&trusted);
+
+            u8             rdigests[256][siglen];
+            merkle::hash_t rhashes[256];
+            for (s32 i = 0; i < 256; ++i)
+                rhashes[i] = merkle::hash_t(rdigests[i], siglen);
+            merkle::branch_t proof(rhashes, 256);
+            CHECK_TRUE(sender.read_range(bin_t(0, 100), bin_t(0, 163), proof) > 0);
+            CHECK_EQUAL(-2, ranged.write_range(bin_t(0, 100), bin_t(0, 163), proof));
+
+            // each resolved signature is combined once, the scratch holds them for the store
+            u8* rscratch = (u8*)Allocator->allocate(proof.size() * siglen, sizeof(void*));
+            g_combine_calls = 0;
+            CHECK_EQUAL(-1, ranged.write_range(bin_t(0, 100), bin_t(0, 163), proof, rscratch));
+            CHECK_EQUAL(proof.size() - 1, g_combine_calls.load());
+            Allocator->deallocate(rscratch);
+            CHECK_TRUE(ranged.is_trusted(bin_t(0, 120)));
+            CHECK_TRUE(ranged.is_trusted(bin_t(4, 7)));
+            CHECK_FALSE(ranged.is_trusted(bin_t(0, 200)));
+
+            merkle::branch_t inside(hashes, layers + 2);
+            CHECK_EQUAL(2, sender.read(bin_t(0, 120), inside, trusted));
+            CHECK_EQUAL(-1, ranged.write(bin_t(0, 120), inside));
+
+            // a batch keeps the ancestors it verified in the items and stores them as they are
+            {
+                trusted.clear();
+                nmem::memclr(data2, size);
+                merkle::tree batched(d2, sig, test_combine_counted);
+                batched.set_trusted(&trusted);
+
+                u8               bdigests[4][layers + 2][siglen];
+                merkle::hash_t   bhashes[4][layers + 2];
+                merkle::branch_t bbranches[4];
+                u8               ancestors[4][layers * siglen];
+                merkle::verify_t items[4];
+                for (u32 k = 0; k < 4; ++k)
+                {
+                    for (s32 i = 0; i < layers + 2; ++i)
+                        bhashes[k][i] = merkle::hash_t(bdigests[k][i], siglen);
+                    bbranches[k] = merkle::branch_t(bhashes[k], layers + 2);
+                    items[k].bin_       = bin_t(0, 300 + (k * 150));
+                    items[k].branch_    = &bbranches[k];
+                    items[k].result_    = 0;
+                    items[k].ancestors_ = k == 3 ? nullptr : ancestors[k];
+                    CHECK_EQUAL(layers + 2, sender.read(items[k].bin_, bbranches[k]));
+                }
+                g_combine_calls = 0;
+                CHECK_EQUAL(3u, batched.write_batch(items, 4, nullptr, nullptr));
+                CHECK_EQUAL(3u * layers, g_combine_calls.load());
+                CHECK_EQUAL(-2, items[3].result_);
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    for (bin_t b = items[k].bin_; b != root; b.to_parent())
+                    {
+                        sender.read(b, s1);
+                        batched.read(b, s2);
+                        CHECK_TRUE(merkle::are_equal(s1, s2));
+                        CHECK_TRUE(batched.is_trusted(b));
+                    }
+                }
+            }
+
+            Allocator->deallocate(tdata);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(TrimmedBranch)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 10;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, test_combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            merkle::ctree  seeder(d1);
+            merkle::hash_t sig;
+            seeder.read(root, sig);
+
+            // the peer keeps the bins it has verified, the seeder keeps the bins the peer acknowledged
+            bin_t const     troot = merkle::tree::trusted_root(root);
+            u8*             tdata = (u8*)Allocator->allocate((u32)binmaps::binmap::size_for(troot), sizeof(void*));
+            u8*             adata = (u8*)Allocator->allocate((u32)binmaps::binmap::size_for(root), sizeof(void*));
+            binmaps::binmap trusted(troot, tdata);
+            binmaps::binmap acked(root, adata);
+            trusted.clear();
+            acked.clear();
+
+            nmem::memclr(data2, size);
+            merkle::data_t d2(root, siglen, data2);
+            merkle::tree   peer(d2, sig, test_combine);
+            peer.set_trusted(&trusted);
+
+            u8             digests[layers + 2][siglen];
+            merkle::hash_t hashes[layers + 2];
+            for (s32 i = 0; i < layers + 2; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            // chunks in order, after the first branch the peer knows most of the uncles
+            u32 signatures = 0;
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                bin_t const      bin(0, i);
+                merkle::branch_t branch(hashes, layers + 2);
+                s32 const        n = seeder.read_trimmed(bin, branch, acked);
+                CHECK_TRUE(n >= 1 && n <= layers + 1);
+                signatures += n;
+                CHECK_EQUAL(-1, peer.write_trimmed(bin, branch, acked));
+                acked.set(bin);
+            }
+            CHECK_TRUE(signatures < ((u32)root.base_length() * (layers + 1)) / 4);
+            CHECK_TRUE(acked.is_filled());
+
+            merkle::hash_t s1, s2;
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                seeder.read(bin_t(0, i), s1);
+                peer.read(bin_t(0, i), s2);
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+            }
+
+            // a corrupted signature is still rejected
+            acked.clear();
+            acked.set(bin_t(0, 1));
+            merkle::branch_t branch(hashes, layers + 2);
+            CHECK_EQUAL(1, seeder.read_trimmed(bin_t(0, 0), branch, acked));
+            digests[0][5] ^= 1;
+            CHECK_EQUAL(-3, peer.write_trimmed(bin_t(0, 0), branch, acked));
+
+            Allocator->deallocate(adata);
+            Allocator->deallocate(tdata);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(BatchVerify)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 12;
+            u32 const   count  = 1000;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, test_combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            merkle::ctree  sender(d1);
+            merkle::hash_t sig;
+            sender.read(root, sig);
+
+            // the branches of every 4th leaf, every 7th branch is corrupted
+            u32 const         per_branch = layers + 2;
+            u8*               digests    = (u8*)Allocator->allocate(count * per_branch * siglen, sizeof(void*));
+            merkle::hash_t*   hashes     = (merkle::hash_t*)Allocator->allocate(count * per_branch * sizeof(merkle::hash_t), sizeof(void*));
+            merkle::branch_t* branches   = (merkle::branch_t*)Allocator->allocate(count * sizeof(merkle::branch_t), sizeof(void*));
+            merkle::verify_t* items      = (merkle::verify_t*)Allocator->allocate(count * sizeof(merkle::verify_t), sizeof(void*));
+            for (u32 i = 0; i < count; ++i)
+            {
+                for (u32 j = 0; j < per_branch; ++j)
+                    hashes[i * per_branch + j] = merkle::hash_t(digests + (i * per_branch + j) * siglen, siglen);
+                branches[i] = merkle::branch_t(hashes + i * per_branch, per_branch);
+                items[i].bin_    = bin_t(0, (u64)i * 4 + (i & 1));
+                items[i].branch_ = &branches[i];
+                items[i].result_    = 0;
+                items[i].ancestors_ = nullptr;
+                CHECK_EQUAL(layers + 2, sender.read(items[i].bin_, branches[i]));
+                if ((i % 7) == 3)
+                    hashes[i * per_branch + (i % layers)].digest_[1] ^= 0x10;
+            }
+
+            nmem::memclr(data2, size);
+            merkle::data_t d2(root, siglen, data2);
+            merkle::tree   receiver(d2, sig, test_combine, test_combine_batch);
+
+            g_batch_calls = 0;
+            u32 const accepted = receiver.write_batch(items, count, test_parallel_for, nullptr);
+            CHECK_TRUE(g_batch_calls.load() > 0);
+            CHECK_EQUAL(count - (count + 3) / 7, accepted);
+
+            merkle::hash_t s1, s2;
+            for (u32 i = 0; i < count; ++i)
+            {
+                CHECK_EQUAL((i % 7) == 3 ? -3 : -1, items[i].result_);
+                sender.read(items[i].bin_, s1);
+                receiver.read(items[i].bin_, s2);
+                CHECK_EQUAL((i % 7) == 3 ? false : true, merkle::are_equal(s1, s2));
+            }
+
+            // the same as writing them one by one
+            u8*            data3 = (u8*)Allocator->allocate(size, sizeof(void*));
+            nmem::memclr(data3, size);
+            merkle::data_t d3(root, siglen, data3);
+            merkle::tree   serial(d3, sig, test_combine);
+            for (u32 i = 0; i < count; ++i)
+                CHECK_EQUAL(items[i].result_, serial.write(items[i].bin_, branches[i]));
+            CHECK_EQUAL(0, nmem::memcmp(data2 + sizeof(bin_t) + siglen, data3 + sizeof(bin_t) + siglen, size - sizeof(bin_t) - siglen));
+
+            Allocator->deallocate(data3);
+            Allocator->deallocate(items);
+            Allocator->deallocate(branches);
+            Allocator->deallocate(hashes);
+            Allocator->deallocate(digests);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(Sparse)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 16;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, test_combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            merkle::ctree  sender(d1);
+            merkle::hash_t sig;
+            sender.read(root, sig);
+
+            // the receiver only holds the signatures of the branches it received
+            bin_t const     proot = merkle::tree::trusted_root(root);
+            u32 const       psize = (u32)binmaps::binmap::size_for(proot);
+            u8*             pdata = (u8*)Allocator->allocate(psize, sizeof(void*));
+            binmaps::binmap present(proot, pdata);
+
+            u32 const        slots  = 256;
+            u32 const        ssize  = (u32)merkle::sparse_t::size_for(siglen, slots);
+            u8*              sdata  = (u8*)Allocator->allocate(ssize, sizeof(void*));
+            u8*              header = (u8*)Allocator->allocate((u32)merkle::data_t::header_size(siglen), sizeof(void*));
+            merkle::sparse_t sparse(root, siglen, slots, sdata, &present);
+            merkle::data_t   d2(root, siglen, header, &sparse);
+            merkle::tree     receiver(d2, sig, test_combine);
+            CHECK_EQUAL(1u, sparse.size());
+            CHECK_TRUE(receiver.has(root));
+            CHECK_FALSE(receiver.has(bin_t(0, 0)));
+
+            u8             digests[layers + 2][siglen];
+            merkle::hash_t hashes[layers + 2];
+            for (s32 i = 0; i < layers + 2; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            u64 const leaves[] = {0, 1, 7, 1000, 1001, 40000, 65535};
+            for (u32 i = 0; i < sizeof(leaves) / sizeof(leaves[0]); ++i)
+            {
+                merkle::branch_t branch(hashes, layers + 2);
+                CHECK_EQUAL(layers + 2, sender.read(bin_t(0, leaves[i]), branch));
+                CHECK_EQUAL(-1, receiver.write(bin_t(0, leaves[i]), branch));
+            }
+            CHECK_TRUE(sparse.size() < 7u * (layers + 1));
+
+            // every held signature matches the sender, absent ones read as zero
+            merkle::hash_t s1, s2;
+            u32 held = 0;
+            for (u64 v = 0; v < root.base_length() * 2 - 1; ++v)
+            {
+                if (!receiver.has(bin_t(v)))
+                    continue;
+                held += 1;
+                sender.read(bin_t(v), s1);
+                receiver.read(bin_t(v), s2);
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+            }
+            CHECK_EQUAL(sparse.size(), held);
+            receiver.read(bin_t(0, 2), s2);
+            CHECK_TRUE(merkle::are_equal(zero_sig, s2));
+
+            // the receiver can serve the branches it holds
+            {
+                merkle::branch_t branch(hashes, layers + 2);
+                CHECK_EQUAL(layers + 2, receiver.read(bin_t(0, 1000), branch));
+                merkle::branch_t missing(hashes, layers + 2);
+                CHECK_EQUAL(-3, receiver.read(bin_t(0, 2), missing));
+            }
+
+            // a corrupted branch is rejected and stores nothing
+            {
+                u32 const        before = sparse.size();
+                merkle::branch_t branch(hashes, layers + 2);
+                sender.read(bin_t(0, 2000), branch);
+                digests[3][0] ^= 1;
+                CHECK_EQUAL(-3, receiver.write(bin_t(0, 2000), branch));
+                CHECK_EQUAL(before, sparse.size());
+            }
+
+            // the table refuses branches it can not hold
+            s32 result = -1;
+            for (u64 i = 2; i < root.base_length() && result == -1; i += 4096)
+            {
+                merkle::branch_t branch(hashes, layers + 2);
+                sender.read(bin_t(0, i), branch);
+                result = receiver.write(bin_t(0, i), branch);
+            }
+            CHECK_EQUAL(-4, result);
+            CHECK_TRUE(sparse.size() <= slots - slots / 4);
+
+            // clearing keeps the root, the receiver accepts branches again
+            sparse.clear();
+            CHECK_EQUAL(1u, sparse.size());
+            CHECK_TRUE(receiver.has(root));
+            CHECK_FALSE(receiver.has(bin_t(0, 1000)));
+            {
+                merkle::branch_t branch(hashes, layers + 2);
+                sender.read(bin_t(0, 1000), branch);
+                CHECK_EQUAL(-1, receiver.write(bin_t(0, 1000), branch));
+                CHECK_TRUE(receiver.has(bin_t(0, 1000)));
+            }
+
+            Allocator->deallocate(header);
+            Allocator->deallocate(sdata);
+            Allocator->deallocate(pdata);
+            Allocator->deallocate(data1);
+        }
+
+        UNITTEST_TEST(Diff)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 12;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u64 const changed[] = {5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 1000, 4095};
+            u32 const k         = sizeof(changed) / sizeof(changed[0]);
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            merkle::data_t d1(root, siglen, data1);
+            merkle::data_t d2(root, siglen, data2);
+            {
+                merkle::tree::builder b1(d1, zero_sig, test_combine);
+                merkle::tree::builder b2(d2, zero_sig, test_combine);
+                u32 c = 0;
+                for (u64 i = 0; i < root.base_length(); ++i)
+                {
+                    test_leaf(i, leaf);
+                    b1.write(bin_t(0, i), leaf);
+                    if (c < k && changed[c] == i)
+                    {
+                        test_leaf(i + 7777, leaf);
+                        c += 1;
+                    }
+                    b2.write(bin_t(0, i), leaf);
+                }
+                CHECK_TRUE(b1.build());
+                CHECK_TRUE(b2.build());
+            }
+            merkle::ctree a(d1);
+            merkle::ctree b(d2);
+
+            // the runs are reported as maximal bins
+            bin_t const expected[] = {bin_t(0, 5), bin_t(1, 3), bin_t(3, 1), bin_t(0, 1000), bin_t(0, 4095)};
+
+            diff_result_t local;
+            local.count_ = 0;
+            s64 const compared = merkle::diff(a, b, test_on_diff, &local);
+            CHECK_EQUAL(5u, local.count_);
+            for (u32 i = 0; i < 5; ++i)
+                CHECK_TRUE(local.bins_[i] == expected[i]);
+            CHECK_TRUE(compared <= 1 + (2 * k * layers));
+            CHECK_TRUE(compared < (s64)root.base_length() / 16);
+
+            diff_result_t same;
+            same.count_ = 0;
+            CHECK_EQUAL(1, merkle::diff(a, a, test_on_diff, &same));
+            CHECK_EQUAL(0u, same.count_);
+
+            // loopback, one fetch per layer
+            bin_t    bins[64];
+            u8       signatures[64 * siglen];
+            remote_t remote;
+            remote.tree_    = &b;
+            remote.fetches_ = 0;
+            diff_result_t remote_result;
+            remote_result.count_ = 0;
+            CHECK_EQUAL(compared, merkle::diff(a, test_fetch, &remote, test_on_diff, &remote_result, bins, signatures, 64));
+            CHECK_EQUAL((u32)layers + 1, remote.fetches_);
+            CHECK_EQUAL(5u, remote_result.count_);
+            for (u32 i = 0; i < 5; ++i)
+                CHECK_TRUE(remote_result.bins_[i] == expected[i]);
+
+            remote_result.count_ = 0;
+            CHECK_EQUAL(-2, merkle::diff(a, test_fetch, &remote, test_on_diff, &remote_result, bins, signatures, 8));
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(KaryTree)
+        {
+            u32 const siglen = 32;
+            u64 const leaves = 1000;
+
+            CHECK_TRUE(merkle::ktree::root_for(leaves, 2) == bin_t(10, 0));
+            CHECK_TRUE(merkle::ktree::root_for(leaves, 4) == bin_t(10, 0));
+            CHECK_TRUE(merkle::ktree::root_for(leaves, 8) == bin_t(12, 0));
+            CHECK_TRUE(merkle::ktree::root_for(leaves, 16) == bin_t(12, 0));
+
+            // with a fanout of 2 the root is the one of the binary tree
+            bin_t const broot = bin_t::to_root(leaves);
+            u32 const   bsize = (u32)merkle::data_t::size_for(broot, siglen);
+            u8*         bdata = (u8*)Allocator->allocate(bsize, sizeof(void*));
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            merkle::data_t        bd(broot, siglen, bdata);
+            merkle::tree::builder builder(bd, zero_sig, merkle::sha256_tree::combine);
+            for (u64 i = 0; i < leaves; ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_EQUAL(0, builder.build(broot));
+            merkle::ctree  binary(bd);
+            merkle::hash_t binary_root;
+            binary.read(broot, binary_root);
+
+            u8             digests[64][siglen];
+            merkle::hash_t hashes[64];
+            for (s32 i = 0; i < 64; ++i)
+                hashes[i] = merkle::hash_t(digests[i], siglen);
+
+            for (u32 fanout = 2; fanout <= 16; fanout *= 2)
+            {
+                bin_t const root  = merkle::ktree::root_for(leaves, fanout);
+                u32 const   size  = (u32)merkle::ktree::size_for(root, fanout, siglen);
+                u8*         data1 = (u8*)Allocator->allocate(size, sizeof(void*));
+                u8*         data2 = (u8*)Allocator->allocate(size, sizeof(void*));
+                nmem::memclr(data1, size);
+
+                merkle::data_t d1(root, siglen, data1);
+                merkle::ktree  sender(d1, fanout, merkle::sha256_tree::combine_n);
+                for (u64 i = 0; i < leaves; ++i)
+                {
+                    test_leaf(i, leaf);
+                    CHECK_EQUAL(0, sender.write(bin_t(0, i), leaf));
+                }
+                merkle::hash_t const& rootsig = sender.build();
+                if (fanout == 2)
+                    CHECK_TRUE(merkle::are_equal(binary_root, rootsig));
+
+                // one level per log2(fanout) layers
+                u32 const levels = (u32)root.layer() / (fanout == 2 ? 1 : fanout == 4 ? 2 : fanout == 8 ? 3 : 4);
+                CHECK_EQUAL(fanout + (levels - 1) * (fanout - 1), merkle::ktree::proof_length(root, fanout, bin_t(0, 0)));
+
+                merkle::data_t d2(root, siglen, data2);
+                merkle::ktree  receiver(d2, fanout, merkle::sha256_tree::combine_n, rootsig);
+
+                u64 const checked[] = {0, 1, 77, 500, 999};
+                for (u32 c = 0; c < 5; ++c)
+                {
+                    merkle::branch_t proof(hashes, 64);
+                    CHECK_EQUAL((s32)merkle::ktree::proof_length(root, fanout, bin_t(0, checked[c])), sender.read(bin_t(0, checked[c]), proof));
+                    CHECK_EQUAL(-1, receiver.verify(bin_t(0, checked[c]), proof));
+                    CHECK_EQUAL(-1, receiver.write(bin_t(0, checked[c]), proof));
+
+                    merkle::hash_t s1, s2;
+                    sender.read(bin_t(0, checked[c]), s1);
+                    receiver.read(bin_t(0, checked[c]), s2);
+                    CHECK_TRUE(merkle::are_equal(s1, s2));
+                }
+
+                // proofs of interior nodes, and a corrupted sibling
+                {
+                    s32 const        shift = root.layer() / (s32)levels;
+                    merkle::branch_t proof(hashes, 64);
+                    sender.read(bin_t(shift, 3), proof);
+                    CHECK_EQUAL(-1, receiver.write(bin_t(shift, 3), proof));
+                    CHECK_EQUAL(-2, receiver.write(bin_t(0, 3), proof));
+                    if (fanout > 2)
+                        CHECK_EQUAL(-2, receiver.write(bin_t(1, 3), proof));
+                }
+                {
+                    merkle::branch_t proof(hashes, 64);
+                    sender.read(bin_t(0, 600), proof);
+                    digests[fanout + 1][5] ^= 1;
+                    CHECK_EQUAL(-3, receiver.write(bin_t(0, 600), proof));
+                }
+
+                Allocator->deallocate(data1);
+                Allocator->deallocate(data2);
+            }
+            Allocator->deallocate(bdata);
+        }
+
+        UNITTEST_TEST(AcceptChunk)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 10;
+            u32 const   csize  = 256;
+            bin_t const root   = bin_t::to_root(1 << layers);
+            u32 const   size   = (u32)merkle::data_t::size_for(root, siglen);
+            u8*         data1  = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*         data2  = (u8*)Allocator->allocate(size, sizeof(void*));
+
+            u8* content = (u8*)Allocator->allocate((u32)root.base_length() * csize, sizeof(void*));
+            for (u32 i = 0; i < (u32)root.base_length() * csize; ++i)
+                content[i] = (u8)((i * 13) ^ (i >> 8));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        d1(root, siglen, data1);
+            merkle::tree::builder builder(d1, zero_sig, merkle::sha256_tree::combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_hash_chunk(content + (i * csize), csize, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+            merkle::ctree  sender(d1);
+            merkle::hash_t sig;
+            sender.read(root, sig);
+
+            u32 const       hsize = (u32)binmaps::binmap::size_for(root);
+            u8*             hdata = (u8*)Allocator->allocate(hsize, sizeof(void*));
+            binmaps::binmap have(root, hdata);
+            have.clear();
+
+            nmem::memclr(data2, size);
+            // room for 40 branches, the burst of 64 chunks is verified in 2 rounds
+            u32 const        count = 64;
+            u64 const        ssize   = merkle::receiver::scratch_size(root, siglen, 40);
+            u8*              scratch = (u8*)Allocator->allocate((u32)ssize, sizeof(void*));
+            CHECK_EQUAL(40u * (((layers + 2) * sizeof(merkle::hash_t)) + (layers * siglen)), ssize);
+            merkle::data_t   d2(root, siglen, data2);
+            merkle::receiver receiver(d2, sig, merkle::sha256_tree::combine, test_hash_chunk, have, scratch, ssize);
+
+            // the proofs of 64 chunks, the leaf of the chunk itself is left zero
+            u8*              pdigests = (u8*)Allocator->allocate(count * (layers + 2) * siglen, sizeof(void*));
+            merkle::hash_t   hashes[count][layers + 2];
+            merkle::branch_t proofs[count];
+            merkle::chunk_t  chunks[count];
+            for (u32 c = 0; c < count; ++c)
+            {
+                for (s32 i = 0; i < layers + 2; ++i)
+                    hashes[c][i] = merkle::hash_t(pdigests + ((c * (layers + 2)) + i) * siglen, siglen);
+                u64 const index = (c * 7) % root.base_length();
+                proofs[c] = merkle::branch_t(hashes[c], layers + 2);
+                CHECK_EQUAL(layers + 2, sender.read(bin_t(0, index), proofs[c]));
+                nmem::memclr(hashes[c][(index & 1) ? 1 : 0].digest_, siglen);
+                chunks[c].bin_    = bin_t(0, index);
+                chunks[c].bytes_  = content + (index * csize);
+                chunks[c].length_ = csize;
+                chunks[c].proof_  = &proofs[c];
+            }
+
+            CHECK_EQUAL(-1, receiver.accept_chunk(chunks[0].bin_, chunks[0].bytes_, csize, proofs[0]));
+            CHECK_TRUE(have.is_filled(chunks[0].bin_));
+            CHECK_EQUAL(0, receiver.accept_chunk(chunks[0].bin_, chunks[0].bytes_, csize, proofs[0]));
+            CHECK_EQUAL(-2, receiver.accept_chunk(bin_t(1, 0), chunks[0].bytes_, csize, proofs[0]));
+
+            // the content has to match the proof
+            CHECK_EQUAL(-3, receiver.accept_chunk(chunks[1].bin_, chunks[2].bytes_, csize, proofs[1]));
+            CHECK_FALSE(have.is_filled(chunks[1].bin_));
+
+            // a burst with a corrupted chunk, chunk 0 is a duplicate
+            content[(chunks[5].bin_.layer_offset() * csize) + 3] ^= 1;
+            u32 const accepted = receiver.accept_chunks(chunks, count, test_parallel_for, nullptr);
+            CHECK_EQUAL(count - 2, accepted);
+            CHECK_EQUAL(0, chunks[0].result_);
+            CHECK_EQUAL(-3, chunks[5].result_);
+            for (u32 c = 0; c < count; ++c)
+            {
+                CHECK_EQUAL(c != 5, have.is_filled(chunks[c].bin_));
+                merkle::hash_t s1, s2;
+                sender.read(chunks[c].bin_, s1);
+                receiver.read(chunks[c].bin_, s2);
+                CHECK_EQUAL(c != 5, merkle::are_equal(s1, s2));
+            }
+
+            Allocator->deallocate(scratch);
+            Allocator->deallocate(pdigests);
+            Allocator->deallocate(hdata);
+            Allocator->deallocate(content);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(HashVectors)
+        {
+            u8 msg[256 * 5];
+            for (u32 i = 0; i < sizeof(msg); ++i)
+                msg[i] = (u8)i;
+            u8 out[32];
+
+            sha256_state sha;
+            sha256_init(&sha);
+            sha256_update(&sha, (u8 const*)"abc", 3);
+            sha256_final(&sha, out);
+            CHECK_TRUE(equal_hex(out, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+            sha256_init(&sha);
+            sha256_update(&sha, msg, 64);
+            sha256_final(&sha, out);
+            CHECK_TRUE(equal_hex(out, "fdeab9acf3710362bd2658cdc9a29e8f9c757fcf9811603a8c447cd1d9151108"));
+
+            // odd sized updates that straddle the block boundaries
+            sha256_init(&sha);
+            for (u32 i = 0; i < sizeof(msg); i += 37)
+                sha256_update(&sha, msg + i, (sizeof(msg) - i) < 37 ? (sizeof(msg) - i) : 37);
+            sha256_final(&sha, out);
+            CHECK_TRUE(equal_hex(out, "d414b085826eb06778483ba35564dc849e643359f69ed9747878ba6e54985bed"));
+
+            blake2s_state b2s;
+            blake2s_init(&b2s);
+            blake2s_update(&b2s, (u8 const*)"abc", 3);
+            blake2s_final(&b2s, out);
+            CHECK_TRUE(equal_hex(out, "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982"));
+
+            blake2s_init(&b2s);
+            blake2s_update(&b2s, msg, 64);
+            blake2s_final(&b2s, out);
+            CHECK_TRUE(equal_hex(out, "56f34e8b96557e90c1f24b52d0c89d51086acf1b00f634cf1dde9233b8eaaa3e"));
+
+            blake2s_init(&b2s);
+            for (u32 i = 0; i < sizeof(msg); i += 37)
+                blake2s_update(&b2s, msg + i, (sizeof(msg) - i) < 37 ? (sizeof(msg) - i) : 37);
+            blake2s_final(&b2s, out);
+            CHECK_TRUE(equal_hex(out, "52ea240758fbbcd27c605dfb70ef0957c9009335d6d0a8d60d219e611ba2e23f"));
+        }
+
+        UNITTEST_TEST(Digest)
+        {
+            CHECK_EQUAL(32, (s32)sizeof(merkle::digest<20>));
+            CHECK_EQUAL(32, (s32)sizeof(merkle::digest<32>));
+            CHECK_EQUAL(64, (s32)sizeof(merkle::digest<64>));
+            CHECK_EQUAL(16, (s32)alignof(merkle::digest<20>));
+
+            merkle::digest<20> a, b;
+            CHECK_TRUE(merkle::is_zero(a));
+            CHECK_TRUE(merkle::are_equal(a, b));
+            CHECK_EQUAL(0, merkle::compare(a, b));
+
+            a.bytes_[19] = 1;
+            CHECK_FALSE(merkle::is_zero(a));
+            CHECK_TRUE(merkle::are_nequal(a, b));
+            CHECK_EQUAL(1, merkle::compare(a, b));
+            CHECK_EQUAL(-1, merkle::compare(b, a));
+
+            // lexicographic, the first differing byte decides
+            b.bytes_[0] = 1;
+            CHECK_EQUAL(-1, merkle::compare(a, b));
+
+            merkle::digest<64> c, d;
+            for (u32 i = 0; i < 64; ++i)
+                c.bytes_[i] = d.bytes_[i] = (u8)(i * 13);
+            CHECK_TRUE(merkle::are_equal(c, d));
+            d.bytes_[63] ^= 0x80;
+            CHECK_FALSE(merkle::are_equal(c, d));
+            CHECK_EQUAL(-1, merkle::compare(c, d));
+
+            // a digest passes to the runtime API as a hash_t view without a copy
+            merkle::digest<32> e, f;
+            for (u32 i = 0; i < 32; ++i)
+                e.bytes_[i] = f.bytes_[i] = (u8)(255 - i);
+            merkle::hash_t he(e);
+            CHECK_TRUE(he.digest_ == e.bytes_);
+            CHECK_EQUAL(32, (s32)he.length_);
+            CHECK_TRUE(merkle::are_equal(he, merkle::hash_t(f)));
+            f.bytes_[4] = 0;
+            CHECK_EQUAL(1, merkle::compare(he, merkle::hash_t(f)));
+            CHECK_EQUAL(-1, merkle::compare(merkle::hash_t(f), he));
+        }
+
+        UNITTEST_TEST(BasicTree)
+        {
+            typedef merkle::sha256_tree tree_t;
+            u32 const   siglen = tree_t::c_digest_size;
+            bin_t const root   = bin_t::to_root(64);
+
+            u64 const size  = tree_t::size_for(root);
+            u8*       data1 = (u8*)Allocator->allocate((u32)size, 16);
+            u8*       data2 = (u8*)Allocator->allocate((u32)size, 16);
+
+            tree_t sender(root, data1);
+            sender.clear();
+            tree_t::digest_t leaf;
+            merkle::hash_t   leaf_hash(leaf.bytes_, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf_hash);
+                CHECK_EQUAL(0, sender.write_leaf(i, leaf));
+            }
+            CHECK_EQUAL(-2, sender.write_leaf(root.base_length(), leaf));
+            tree_t::digest_t const root_digest = sender.build();
+
+            // the runtime builder with the policy adapter results in the same tree
+            u32 const             rsize = (u32)merkle::data_t::size_for(root, siglen);
+            u8*                   rdata = (u8*)Allocator->allocate(rsize, sizeof(void*));
+            u8                    rroot_digest[siglen] = {0};
+            merkle::hash_t        rroot_sig(rroot_digest, siglen);
+            merkle::data_t        rd(root, siglen, rdata);
+            merkle::tree::builder builder(rd, rroot_sig, tree_t::combine);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf_hash);
+                builder.write(bin_t(0, i), leaf_hash);
+            }
+            CHECK_TRUE(builder.build());
+            CHECK_EQUAL(0, nmem::memcmp(data1 + tree_t::c_header_size, rdata + sizeof(bin_t) + siglen, (u32)((root.base_length() * 2 - 1) * siglen)));
+
+            // a receiver only trusts the root digest and accepts verified branches
+            tree_t           receiver(root, data2, root_digest);
+            tree_t::digest_t branch[16];
+            bin_t const      bin(0, 37);
+            s32 const        n = sender.read(bin, branch, 16);
+            CHECK_EQUAL(root.layer() + 1, n);
+            CHECK_EQUAL(-2, sender.read(bin, branch, 3));
+            CHECK_EQUAL(0, receiver.write(bin, branch, n));
+
+            tree_t::digest_t a, b;
+            sender.read(bin, a);
+            receiver.read(bin, b);
+            CHECK_TRUE(tree_t::are_equal(a, b));
+            sender.read(bin.parent().parent(), a);
+            receiver.read(bin.parent().parent(), b);
+            CHECK_TRUE(tree_t::are_equal(a, b));
+            CHECK_TRUE(tree_t::are_equal(root_digest, receiver.root_digest()));
+
+            // a corrupted uncle must be rejected and leave the receiver untouched
+            receiver.read(bin_t(0, 5), b);
+            CHECK_TRUE(tree_t::is_zero(b));
+            sender.read(bin_t(0, 5), branch, 16);
+            branch[3].bytes_[7] ^= 1;
+            CHECK_EQUAL(-3, receiver.write(bin_t(0, 5), branch, n));
+            receiver.read(bin_t(0, 5), b);
+            CHECK_TRUE(tree_t::is_zero(b));
+
+            Allocator->deallocate(rdata);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        UNITTEST_TEST(TruncatedTree)
+        {
+            typedef merkle::sha256_truncated_tree tree_t;
+            u32 const   siglen = tree_t::c_digest_size;
+            bin_t const root   = bin_t::to_root(1024);
+
+            // 32 bytes per leaf, 16 per interior node instead of 32
+            u64 const size = tree_t::size_for(root);
+            CHECK_TRUE(size * 4 <= (merkle::sha256_tree::size_for(root) * 3) + 256);
+
+            u8* data1 = (u8*)Allocator->allocate((u32)size, 16);
+            u8* data2 = (u8*)Allocator->allocate((u32)size, 16);
+
+            tree_t sender(root, data1);
+            sender.clear();
+            tree_t::digest_t leaf;
+            merkle::hash_t   leaf_hash(leaf.bytes_, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf_hash);
+                CHECK_EQUAL(0, sender.write_leaf(i, leaf));
+            }
+            tree_t::digest_t const root_digest = sender.build();
+            CHECK_FALSE(merkle::is_zero(root_digest));
+
+            // the same leaves with full interior digests give a different root
+            u8* full = (u8*)Allocator->allocate((u32)merkle::sha256_tree::size_for(root), 16);
+            merkle::sha256_tree reference(root, full);
+            for (u64 i = 0; i < root.base_length(); ++i)
+                reference.write_leaf(i, sender.leaf(i));
+            CHECK_FALSE(merkle::are_equal(root_digest, reference.build()));
+
+            // a proof is the full leaf pair and the truncated uncles
+            tree_t             receiver(root, data2, root_digest);
+            tree_t::digest_t   pair[2];
+            tree_t::interior_t uncles[16];
+            bin_t const        bin(0, 613);
+            s32 const          n = sender.read(bin, pair, uncles, 16);
+            CHECK_EQUAL(root.layer() - 1, n);
+            CHECK_EQUAL(-2, sender.read(bin, pair, uncles, 3));
+            CHECK_EQUAL(-1, sender.read(bin_t(1, 3), pair, uncles, 16));
+            CHECK_EQUAL(-2, receiver.write(bin, pair, uncles, n - 1));
+            CHECK_EQUAL(0, receiver.write(bin, pair, uncles, n));
+            CHECK_TRUE(merkle::are_equal(sender.leaf(613), receiver.leaf(613)));
+            CHECK_TRUE(merkle::are_equal(sender.leaf(612), receiver.leaf(612)));
+
+            // the receiver can serve what it verified
+            tree_t::digest_t   pair2[2];
+            tree_t::interior_t uncles2[16];
+            CHECK_EQUAL(n, receiver.read(bin, pair2, uncles2, 16));
+            for (s32 i = 0; i < n; ++i)
+                CHECK_TRUE(merkle::are_equal(uncles[i], uncles2[i]));
+
+            // a corrupted uncle or leaf is rejected
+            sender.read(bin_t(0, 5), pair, uncles, 16);
+            uncles[4].bytes_[3] ^= 1;
+            CHECK_EQUAL(-3, receiver.write(bin_t(0, 5), pair, uncles, n));
+            uncles[4].bytes_[3] ^= 1;
+            pair[1].bytes_[31] ^= 1;
+            CHECK_EQUAL(-3, receiver.write(bin_t(0, 5), pair, uncles, n));
+            CHECK_TRUE(merkle::is_zero(receiver.leaf(5)));
+            pair[1].bytes_[31] ^= 1;
+            CHECK_EQUAL(0, receiver.write(bin_t(0, 5), pair, uncles, n));
+
+            // a sub-tree that does not start at leaf 0 takes the same absolute leaf offsets
+            {
+                bin_t const sub(4, 3);
+                tree_t      part(sub, data1);
+                part.clear();
+                CHECK_EQUAL(-2, part.write_leaf(0, leaf));
+                for (u64 i = sub.base_offset(); i < sub.base_offset() + sub.base_length(); ++i)
+                {
+                    test_leaf(i, leaf_hash);
+                    CHECK_EQUAL(0, part.write_leaf(i, leaf));
+                }
+                tree_t::digest_t const sub_digest = part.build();
+                test_leaf(50, leaf_hash);
+                CHECK_TRUE(merkle::are_equal(leaf, part.leaf(50)));
+
+                tree_t sub_receiver(sub, data2, sub_digest);
+                s32 const m = part.read(bin_t(0, 57), pair, uncles, 16);
+                CHECK_EQUAL(sub.layer() - 1, m);
+                CHECK_EQUAL(0, sub_receiver.write(bin_t(0, 57), pair, uncles, m));
+                CHECK_TRUE(merkle::are_equal(part.leaf(57), sub_receiver.leaf(57)));
+                CHECK_EQUAL(m, sub_receiver.read(bin_t(0, 56), pair2, uncles2, 16));
+                for (s32 i = 0; i < m; ++i)
+                    CHECK_TRUE(merkle::are_equal(uncles[i], uncles2[i]));
+            }
+
+            Allocator->deallocate(full);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+        }
+
+        struct lazy_reader_t
+        {
+            merkle::lazy_tree const* lazy_;
+            merkle::ctree const*     full_;
+            std::atomic<u32>         failed_;
+        };
+
+        static void lazy_read_job(void* _ctx, u32 _index)
+        {
+            lazy_reader_t* reader = (lazy_reader_t*)_ctx;
+            u8             d1[14][32], d2[14][32];
+            merkle::hash_t h1[14], h2[14];
+            for (s32 i = 0; i < 14; ++i)
+            {
+                h1[i] = merkle::hash_t(d1[i], 32);
+                h2[i] = merkle::hash_t(d2[i], 32);
+            }
+            merkle::branch_t b1(h1, 14), b2(h2, 14);
+            bin_t const      bin(0, (_index * 97) & 4095);
+            reader->lazy_->read(bin, b1);
+            reader->full_->read(bin, b2);
+            for (u32 i = 0; i < b2.size(); ++i)
+            {
+                if (!merkle::are_equal(*b1[i], *b2[i]))
+                    reader->failed_ += 1;
+            }
+        }
+
+        UNITTEST_TEST(LazyTree)
+        {
+            u32 const   siglen = 32;
+            s32 const   layers = 12;
+            bin_t const root   = bin_t::to_root(1 << layers);
+
+            // leaves and the top 4 layers, a little over half of the full tree
+            u64 const size = merkle::lazy_tree::size_for(root, siglen, 4);
+            CHECK_TRUE(size * 3 < merkle::data_t::size_for(root, siglen) * 2);
+
+            u32 const full_size = (u32)merkle::data_t::size_for(root, siglen);
+            u32 const cache_size = (u32)merkle::lru_cache::size_for(siglen, 4, 16);
+            u8*       data1      = (u8*)Allocator->allocate(full_size, sizeof(void*));
+            u8*       data2      = (u8*)Allocator->allocate((u32)size, sizeof(void*));
+            u8*       data3      = (u8*)Allocator->allocate(cache_size, sizeof(void*));
+
+            u8             root_digest[siglen] = {0};
+            merkle::hash_t root_sig(root_digest, siglen);
+            merkle::data_t d1(root, siglen, data1);
+            merkle::data_t d2(root, siglen, data2);
+
+            merkle::lru_cache     cache(siglen, 4, 16, data3);
+            merkle::lazy_tree     lazy(d2, 4, test_combine, &cache);
+            merkle::tree::builder builder(d1, root_sig, test_combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+                CHECK_EQUAL(0, lazy.write(bin_t(0, i), leaf));
+            }
+            CHECK_EQUAL(-1, lazy.write(bin_t(1, 0), leaf));
+            CHECK_TRUE(builder.build());
+            lazy.build();
+            merkle::ctree full(d1);
+
+            // every signature reads the same, whether stored or computed
+            u8             digest[siglen];
+            merkle::hash_t s1, s2(digest, siglen);
+            for (u64 v = 0; v < root.base_length() * 2 - 1; v += 5)
+            {
+                full.read(bin_t(v), s1);
+                CHECK_EQUAL(0, lazy.read(bin_t(v), s2));
+                CHECK_TRUE(merkle::are_equal(s1, s2));
+            }
+            CHECK_EQUAL(-1, lazy.read(bin_t(root.value() * 2 + 1), s2));
+
+            // so do the branches, the sibling leaf has the same uncles and finds them in the cache
+            u8             d3[layers + 2][siglen], d4[layers + 2][siglen];
+            merkle::hash_t h3[layers + 2], h4[layers + 2];
+            for (s32 i = 0; i < layers + 2; ++i)
+            {
+                h3[i] = merkle::hash_t(d3[i], siglen);
+                h4[i] = merkle::hash_t(d4[i], siglen);
+            }
+            merkle::branch_t b3(h3, layers + 2), b4(h4, layers + 2);
+            cache.clear();
+            CHECK_EQUAL(layers + 2, lazy.read(bin_t(0, 1000), b3));
+            CHECK_EQUAL(layers + 2, full.read(bin_t(0, 1000), b4));
+            for (s32 i = 0; i < layers + 2; ++i)
+                CHECK_TRUE(merkle::are_equal(*b3[i], *b4[i]));
+            u64 const misses = cache.misses();
+            CHECK_EQUAL(0, cache.hits());
+            CHECK_TRUE(misses > 0);
+
+            merkle::branch_t b5(h3, layers + 2);
+            CHECK_EQUAL(layers + 2, lazy.read(bin_t(0, 1001), b5));
+            CHECK_EQUAL(misses, cache.hits());
+            CHECK_EQUAL(misses, cache.misses());
+
+            merkle::branch_t small(h3, layers);
+            CHECK_EQUAL(-2, lazy.read(bin_t(0, 7), small));
+
+            // readers on several threads share the cache
+            cache.reset_counters();
+            lazy_reader_t reader;
+            reader.lazy_ = &lazy;
+            reader.full_ = &full;
+            reader.failed_ = 0;
+            test_parallel_for(lazy_read_job, &reader, 512, nullptr);
+            CHECK_EQUAL(0, (u32)reader.failed_);
+            CHECK_TRUE(cache.hits() + cache.misses() > 0);
+
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+            Allocator->deallocate(data3);
+        }
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+        UNITTEST_TEST(Store)
+        {
+            const char* path   = "/tmp/cbinmaps_test_merkle_store.bin";
+            u32 const   siglen = 32;
+            bin_t const root   = bin_t::to_root(1 << 12);
+
+            merkle::store_t store;
+            CHECK_EQUAL(0, store.create(path, root, siglen, merkle::c_algorithm_sha256, merkle::LAYOUT_LAYER_MAJOR));
+
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            merkle::data_t        data = store.data();
+            merkle::tree::builder builder(data, zero_sig, merkle::sha256_tree::combine);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            for (u64 i = 0; i < root.base_length(); ++i)
+            {
+                test_leaf(i, leaf);
+                builder.write(bin_t(0, i), leaf);
+            }
+            CHECK_TRUE(builder.build());
+
+            u8             root_digest[siglen];
+            merkle::hash_t sig;
+            {
+                merkle::ctree tree(data);
+                tree.read(root, sig);
+                nmem::memcpy(root_digest, sig.digest_, siglen);
+            }
+            CHECK_EQUAL(0, store.flush());
+            store.close();
+
+            // the header has to match
+            CHECK_EQUAL(-3, store.open(path, merkle::c_algorithm_blake2s));
+            CHECK_EQUAL(-1, store.open("/tmp/cbinmaps_test_merkle_store.none", merkle::c_algorithm_sha256));
+
+            // reopen and serve a branch straight from the mapping
+            CHECK_EQUAL(0, store.open(path, merkle::c_algorithm_sha256, true));
+            CHECK_TRUE(store.get_root() == root);
+            CHECK_EQUAL(siglen, store.get_siglen());
+            {
+                merkle::data_t reopened = store.data();
+                CHECK_TRUE(reopened.get_layout() == merkle::LAYOUT_LAYER_MAJOR);
+                merkle::ctree  served(reopened);
+                served.read(root, sig);
+                CHECK_EQUAL(0, nmem::memcmp(root_digest, sig.digest_, siglen));
+
+                u8             digests[16][siglen];
+                merkle::hash_t hashes[16];
+                for (s32 i = 0; i < 16; ++i)
+                    hashes[i] = merkle::hash_t(digests[i], siglen);
+                merkle::branch_t branch(hashes, 16);
+                CHECK_EQUAL(root.layer() + 2, served.read(bin_t(0, 1234), branch));
+
+                u8*            rdata = (u8*)Allocator->allocate((u32)merkle::data_t::size_for(root, siglen), sizeof(void*));
+                nmem::memclr(rdata, (u32)merkle::data_t::size_for(root, siglen));
+                merkle::data_t rd(root, siglen, rdata);
+                merkle::tree   receiver(rd, merkle::hash_t(root_digest, siglen), merkle::sha256_tree::combine);
+                CHECK_EQUAL(-1, receiver.write(bin_t(0, 1234), branch));
+                Allocator->deallocate(rdata);
+            }
+            store.close();
+
+            // a different version is rejected
+            {
+                FILE* f = fopen(path, "r+b");
+                u32   version = 99;
+                fseek(f, 4, SEEK_SET);
+                fwrite(&version, 4, 1, f);
+                fclose(f);
+            }
+            CHECK_EQUAL(-2, store.open(path, merkle::c_algorithm_sha256));
+
+            // so is an unknown layout or a signature length that is not a multiple of 4
+            {
+                FILE* f = fopen(path, "r+b");
+                u32   fields[2] = {merkle::store_header_t::c_version, 0};
+                fseek(f, 4, SEEK_SET);
+                fwrite(&fields[0], 4, 1, f);
+                fields[1] = 7;
+                fseek(f, 16, SEEK_SET);
+                fwrite(&fields[1], 4, 1, f);
+                fclose(f);
+            }
+            CHECK_EQUAL(-2, store.open(path, merkle::c_algorithm_sha256));
+            {
+                FILE* f = fopen(path, "r+b");
+                u32   fields[2] = {siglen - 2, merkle::LAYOUT_LAYER_MAJOR};
+                fseek(f, 12, SEEK_SET);
+                fwrite(fields, 4, 2, f);
+                fclose(f);
+            }
+            CHECK_EQUAL(-2, store.open(path, merkle::c_algorithm_sha256));
+            {
+                FILE* f = fopen(path, "r+b");
+                u32   fields[1] = {siglen};
+                fseek(f, 12, SEEK_SET);
+                fwrite(fields, 4, 1, f);
+                fclose(f);
+            }
+            CHECK_EQUAL(0, store.open(path, merkle::c_algorithm_sha256, true));
+            store.close();
+            unlink(path);
+        }
+
+        UNITTEST_TEST(FileHasher)
+        {
+            const char* path   = "/tmp/cbinmaps_test_merkle_file.bin";
+            u32 const   siglen = 32;
+            u32 const   chunk  = 4096;
+            u32 const   length = (300 * 1024) + 123;
+
+            u8* content = (u8*)Allocator->allocate(length, sizeof(void*));
+            for (u32 i = 0; i < length; ++i)
+                content[i] = (u8)((i * 7) ^ (i >> 9));
+            {
+                FILE* f = fopen(path, "wb");
+                fwrite(content, 1, length, f);
+                fclose(f);
+            }
+
+            merkle::content_hasher hasher(chunk, siglen, test_hash_chunk, test_parallel_for, nullptr);
+            CHECK_EQUAL(-1, hasher.open("/tmp/cbinmaps_test_merkle_file.none"));
+            CHECK_EQUAL(0, hasher.open(path));
+            CHECK_EQUAL((u64)length, hasher.get_size());
+            CHECK_EQUAL((u64)76, hasher.get_chunks());
+            bin_t const root = hasher.get_root();
+            CHECK_TRUE(root == bin_t::to_root(76));
+
+            // the reference, every chunk hashed up front
+            u32 const      size  = (u32)merkle::data_t::size_for(root, siglen);
+            u8*            data1 = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8*            data2 = (u8*)Allocator->allocate(size, sizeof(void*));
+            u8             zero_digest[siglen] = {0};
+            merkle::hash_t zero_sig(zero_digest, siglen);
+            u8             leaf_digest[siglen];
+            merkle::hash_t leaf(leaf_digest, siglen);
+            merkle::data_t d1(root, siglen, data1);
+            merkle::tree::builder reference(d1, zero_sig, merkle::sha256_tree::combine);
+            for (u32 i = 0; i < 76; ++i)
+            {
+                u32 const n = (length - (i * chunk)) < chunk ? (length - (i * chunk)) : chunk;
+                test_hash_chunk(content + (i * chunk), n, leaf);
+                reference.write(bin_t(0, i), leaf);
+            }
+            CHECK_EQUAL(0, reference.build(root));
+            merkle::ctree  expected(d1);
+            merkle::hash_t expected_root;
+            expected.read(root, expected_root);
+
+            // a window of 8 chunks, so the tree is built in 16 sub-trees
+            u8* window = (u8*)Allocator->allocate(8 * chunk, sizeof(void*));
+            {
+                merkle::data_t        d2(root, siglen, data2);
+                merkle::tree::builder builder(d2, zero_sig, merkle::sha256_tree::combine);
+                CHECK_EQUAL(0, hasher.hash(builder, window, 8 * chunk));
+                merkle::ctree  hashed(d2);
+                merkle::hash_t hashed_root;
+                hashed.read(root, hashed_root);
+                CHECK_TRUE(merkle::are_equal(expected_root, hashed_root));
+                CHECK_EQUAL(-2, hasher.hash(builder, window, chunk - 1));
+            }
+
+            // serial, an already open file and a window larger than the tree
+            {
+                merkle::content_hasher serial(chunk, siglen, test_hash_chunk, nullptr, nullptr);
+                FILE* f = fopen(path, "rb");
+                serial.attach(fileno(f));
+                CHECK_EQUAL((u64)length, serial.get_size());
+                u8* large = (u8*)Allocator->allocate(256 * chunk, sizeof(void*));
+                merkle::data_t        d2(root, siglen, data2);
+                merkle::tree::builder builder(d2, zero_sig, merkle::sha256_tree::combine);
+                CHECK_EQUAL(0, serial.hash(builder, large, 256 * chunk));
+                merkle::ctree  hashed(d2);
+                merkle::hash_t hashed_root;
+                hashed.read(root, hashed_root);
+                CHECK_TRUE(merkle::are_equal(expected_root, hashed_root));
+                serial.close();
+                fclose(f);
+                Allocator->deallocate(large);
+            }
+
+            // the tree has to hold every chunk
+            {
+                bin_t const           small = bin_t::to_root(32);
+                merkle::data_t        d3(small, siglen, data2);
+                merkle::tree::builder builder(d3, zero_sig, merkle::sha256_tree::combine);
+                CHECK_EQUAL(-2, hasher.hash(builder, window, 8 * chunk));
+            }
+
+            hasher.close();
+            unlink(path);
+            Allocator->deallocate(window);
+            Allocator->deallocate(data1);
+            Allocator->deallocate(data2);
+            Allocator->deallocate(content);
+        }
+#endif
+
+#if defined(TARGET_LINUX) || defined(TARGET_MAC)
+        UNITTEST_TEST(Huge)
+        {
+            // 2^28 leaves with 32 byte signatures need 16 GiB, use sparse memory
+            u32 const   siglen = 32;
+            s32 const   layers = 28;
+            bin_t const root   = bin_t::to_root((u64)1 << layers);
+            u64 const   size   = merkle::data_t::size_for(root, siglen);
+            CHECK_TRUE(size > ((u64)1 << 32));
+
+            void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            CHECK_TRUE(mem != MAP_FAILED);
+            if (mem == MAP_FAILED)
+                return;
+
+            // a branch for the last leaf: the leaf, its sibling and the uncles up to the root
+            u8             digests[layers + 2][siglen];
+            merkle::hash_t hashes[layers + 2];
+            merkle::hash_t branch_hashes[layers + 2];
+            u8             branch_digests[layers + 2][siglen];
+            for (s32 i = 0; i < layers + 2; ++i)
+            {
+                for (u32 j = 0; j < siglen; ++j)
+                    digests[i][j] = (u8)(i * 7 + j);
+                hashes[i]        = merkle::hash_t(digests[i], siglen);
+                branch_hashes[i] = merkle::hash_t(branch_digests[i], siglen);
+            }
+
+            bin_t const leaf(0, ((u64)1 << layers) - 1);
+
+            u8             root_digest[siglen];
+            merkle::hash_t root_sig(root_digest, siglen);
+            test_combine(hashes[1], hashes[0], root_sig);
+            for (s32 i = 2; i <= layers; ++i)
+                test_combine(hashes[i], root_sig, root_sig);
+
+            merkle::branch_t branch(branch_hashes, layers + 2);
+            for (s32 i = 1; i >= 0; --i)
+                branch.push(hashes[i]);
+            for (s32 i = 2; i <= layers; ++i)
+                branch.push(hashes[i]);
+
+            merkle::data_t data(root, siglen, (u8*)mem);
+            merkle::tree   tree(data, root_sig, test_combine);
+            CHECK_EQUAL(-1, tree.write(leaf, branch));
+
+            // read back the leaf, which lives far beyond the first 4 GiB
+            merkle::hash_t sig;
+            CHECK_EQUAL(0, tree.read(leaf, sig));
+            CHECK_TRUE((u64)(sig.digest_ - (u8*)mem) > ((u64)1 << 32));
+            CHECK_TRUE(merkle::are_equal(sig, hashes[0]));
+            CHECK_EQUAL(0, tree.read(leaf.sibling(), sig));
+            CHECK_TRUE(merkle::are_equal(sig, hashes[1]));
+
+            // a corrupted branch must be rejected
+            merkle::branch_t bad(branch_hashes, layers + 2);
+            for (s32 i = 1; i >= 0; --i)
+                bad.push(hashes[i]);
+            for (s32 i = 2; i <= layers; ++i)
+                bad.push(hashes[(i == layers) ? 0 : i]);
+            CHECK_EQUAL(-3, tree.write(leaf, bad));
+
+            munmap(mem, size);
+        }
+#endif
+    }
+}
+UNITTEST_SUITE_END
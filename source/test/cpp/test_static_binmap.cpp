@@ -0,0 +1,160 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+#include "ccore/c_debug.h"
+#include "cbase/c_memory.h"
+#include "cbinmaps/binmap.h"
+#include "cbinmaps/static_binmap.h"
+#include "cbinmaps/bin.h"
+
+#include "cunittest/cunittest.h"
+#include "cbinmaps/test_allocator.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(static_binmap)
+{
+    UNITTEST_FIXTURE(main)
+    {
+        UNITTEST_ALLOCATOR;
+
+        u8* data1     = nullptr;
+        u32 data_size = 0;
+
+        UNITTEST_FIXTURE_SETUP()
+        {
+            data_size = binmaps::data::size_for(bin_t::to_root(4096));
+            data1     = (u8*)Allocator->allocate(data_size, sizeof(void*));
+        }
+        UNITTEST_FIXTURE_TEARDOWN()
+        {
+            Allocator->deallocate(data1);
+        }
+
+        UNITTEST_TEST(SetGet)
+        {
+            binmaps::static_binmap<16> bs;
+            CHECK_EQUAL(binmaps::static_binmap<16>::c_data_words * 8, (u32)sizeof(bs)); // only the inline data
+
+            CHECK_TRUE(bs.is_empty());
+            CHECK_EQUAL(bin_t(4, 0).value(), bs.root().value());
+
+            bin_t b3(1, 0), b2(0, 1), b4(0, 2), b6(1, 1), b7(2, 0);
+            bs.set(b3);
+            CHECK_TRUE(bs.is_filled(b3));
+            CHECK_TRUE(bs.is_filled(b2));
+            CHECK_TRUE(bs.is_empty(b4));
+            CHECK_TRUE(bs.is_empty(b6));
+            CHECK_FALSE(bs.is_filled(b7));
+            CHECK_FALSE(bs.is_empty(b7));
+            bs.set(bin_t(1, 1));
+            CHECK_TRUE(bs.is_filled(bin_t(2, 0)));
+
+            bs.reset(bin_t(0, 3));
+            CHECK_FALSE(bs.is_filled(bin_t(2, 0)));
+            CHECK_FALSE(bs.is_empty(bin_t(2, 0)));
+            CHECK_EQUAL(bin_t(0, 3).value(), bs.find_empty().value());
+            CHECK_EQUAL(bin_t(0, 0).value(), bs.find_filled().value());
+
+            bs.fill();
+            CHECK_TRUE(bs.is_filled());
+            CHECK_EQUAL(bin_t::NONE.value(), bs.find_empty().value());
+            bs.clear();
+            CHECK_TRUE(bs.is_empty(bin_t::ALL));
+            CHECK_EQUAL(bin_t::NONE.value(), bs.find_filled().value());
+        }
+
+        UNITTEST_TEST(Staircase)
+        {
+            binmaps::static_binmap<4096> staircase;
+
+            for (int i = 0; i < 12; i++)
+                staircase.set(bin_t(i, 1));
+
+            CHECK_FALSE(staircase.is_filled(bin_t(12, 0)));
+            CHECK_FALSE(staircase.is_empty(bin_t(12, 0)));
+
+            staircase.set(bin_t(0, 0));
+            CHECK_TRUE(staircase.is_filled(bin_t(12, 0)));
+
+            staircase.reset(bin_t(5, 1));
+            CHECK_EQUAL(bin_t(5, 1).value(), staircase.find_empty().value());
+        }
+
+        UNITTEST_TEST(NotPowerOf2)
+        {
+            // 100 base bins in a tree of 128, the 28 bins past the end are never found
+            binmaps::static_binmap<100> bs;
+            CHECK_EQUAL(100, (s32)bs.length());
+            CHECK_EQUAL(bin_t(7, 0).value(), bs.root().value());
+            CHECK_TRUE(bs.is_empty());
+            CHECK_FALSE(bs.is_filled());
+            CHECK_EQUAL(bin_t(6, 0).value(), bs.find_empty().value());
+            CHECK_EQUAL(bin_t::NONE.value(), bs.find_filled().value());
+
+            for (u64 i = 0; i < 99; ++i)
+                bs.set(bin_t(0, i));
+            CHECK_FALSE(bs.is_filled());
+            CHECK_EQUAL(bin_t(0, 99).value(), bs.find_empty().value());
+            bs.set(bin_t(0, 99));
+            CHECK_TRUE(bs.is_filled());
+            CHECK_TRUE(bs.is_filled(bin_t(3, 12)));
+            CHECK_EQUAL(bin_t::NONE.value(), bs.find_empty().value());
+
+            // a bin straddling the end only affects the bins before the end
+            bs.reset(bin_t(3, 12));
+            CHECK_FALSE(bs.is_filled());
+            CHECK_TRUE(bs.is_empty(bin_t(2, 24)));
+            CHECK_EQUAL(bin_t(2, 24).value(), bs.find_empty().value());
+            bs.set(bin_t(4, 6));
+            CHECK_TRUE(bs.is_filled());
+
+            bs.clear();
+            bs.set(bin_t(0, 98));
+            CHECK_EQUAL(bin_t(0, 98).value(), bs.find_filled().value());
+            bs.reset(bin_t(0, 98));
+            CHECK_TRUE(bs.is_empty());
+
+            bs.fill();
+            CHECK_TRUE(bs.is_filled());
+            bs.reset(bin_t(0, 0));
+            CHECK_EQUAL(bin_t(0, 0).value(), bs.find_empty().value());
+        }
+
+        UNITTEST_TEST(Interop)
+        {
+            nmem::memclr(data1, data_size);
+
+            binmaps::static_binmap<64> window;
+            binmaps::binmap            have(binmaps::user_data(bin_t::to_root(64), data1));
+
+            window.set(bin_t(2, 0));
+            window.set(bin_t(2, 2));
+            window.set(bin_t(1, 7));
+            have.set(bin_t(2, 0));
+
+            // a view is a regular binmap over the same bits
+            binmaps::binmap view = window.view();
+            CHECK_TRUE(window.read_am_at(bin_t(2, 2)));
+            CHECK_TRUE(view.is_filled(bin_t(2, 2)));
+            CHECK_EQUAL(bin_t(2, 2).value(), binmaps::find_complement(have, view, 0).value());
+
+            binmaps::copy(have, view, bin_t(4, 0));
+            CHECK_TRUE(have.is_filled(bin_t(2, 2)));
+            CHECK_TRUE(have.is_filled(bin_t(1, 7)));
+            CHECK_TRUE(have.is_empty(bin_t(2, 1)));
+            CHECK_EQUAL(bin_t::NONE.value(), binmaps::find_complement(have, view, 0).value());
+
+            // and the other way around
+            have.set(bin_t(3, 4));
+            binmaps::copy(view, have, bin_t(5, 1));
+            CHECK_TRUE(window.is_filled(bin_t(3, 4)));
+            CHECK_TRUE(window.is_empty(bin_t(3, 5)));
+            CHECK_EQUAL(bin_t(2, 1).value(), window.find_empty().value());
+
+            // a const window can be the source
+            binmaps::static_binmap<64> const& source = window;
+            CHECK_EQUAL(bin_t::NONE.value(), binmaps::find_complement(have, source.view(), bin_t(5, 0), 0).value());
+        }
+    }
+}
+UNITTEST_SUITE_END